@@ -0,0 +1,6 @@
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    src/plugins/geometryloaders/amf \
+    src/plugins/geometryloaders/gcode \
+    tests
@@ -1,19 +1,27 @@
 TARGET = amfgeometryloader
-QT += core-private 3dcore 3dcore-private 3drender 3drender-private
+QT += core-private concurrent 3dcore 3dcore-private 3drender 3drender-private
 CONFIG += assimp
 
 HEADERS += \
     amfgeometryloader.h \
-    basegeometryloader_p.h
+    basegeometryloader_p.h \
+    meshsimplifier.h
 
 SOURCES += \
     amfgeometryloader.cpp \
     amfgeometryloaderplugin.cpp \
-    basegeometryloader.cpp
+    basegeometryloader.cpp \
+    meshsimplifier.cpp
 
 DISTFILES += \
     amf.json
 
+include(../shared/shared.pri)
+
+# -O3 and square roots without errno, so that the tangent loops vectorize
+CONFIG += optimize_full
+gcc: QMAKE_CXXFLAGS += -fno-math-errno
+
 PLUGIN_TYPE = geometryloaders
 PLUGIN_CLASS_NAME = AmfGeometryLoaderPlugin
 load(qt_build_config)
@@ -38,6 +38,13 @@
 ****************************************************************************/
 
 #include "basegeometryloader_p.h"
+#include "meshsimplifier.h"
+#include "vertexquantizer.h"
+
+#include <QtConcurrent/qtconcurrentmap.h>
+#include <QtCore/qhash.h>
+#include <QtCore/qstringlist.h>
+#include <QtCore/qvariant.h>
 
 #include <Qt3DRender/qattribute.h>
 #include <Qt3DRender/qbuffer.h>
@@ -46,16 +53,92 @@
 #include <Qt3DRender/private/qaxisalignedboundingbox_p.h>
 #include <Qt3DRender/private/renderlogging_p.h>
 
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <numeric>
+
 QT_BEGIN_NAMESPACE
 
 namespace Qt3DRender {
 
 Q_LOGGING_CATEGORY(BaseGeometryLoaderLog, "Qt3D.BaseGeometryLoader", QtWarningMsg)
 
+// moves each item to its new index
+template <typename T>
+static void reorder(QVector<T>& items, const QVector<int>& order)
+{
+    QVector<T> reordered(items.size());
+    for (int i = 0; i < items.size(); ++i)
+        reordered[order.at(i)] = items.at(i);
+    items = reordered;
+}
+
+// the number of items processed per task of the thread pool
+static const int BlockSize = 64 * 1024;
+
+// the number of hash buckets that vertices are welded in, in parallel
+static const int WeldBucketCount = 1024;
+
+// mm, about the precision of the positions of a large model in floats
+static const float DefaultWeldTolerance = 1e-4f;
+
+// the number of vertices in the post-transform cache that the triangles are
+// reordered for, and that the ACMR is measured with
+static const int VertexCacheSize = 16;
+
+struct IndexRange
+{
+    int begin;
+    int end;
+};
+
+// calls function(begin, end) for blocks of [0, count) in parallel, each item
+// is processed by one task only, so the result does not depend on scheduling
+template <typename Function>
+static void blockingForRanges(int count, Function function)
+{
+    if (count <= BlockSize) {
+        function(0, count);
+        return;
+    }
+
+    QVector<IndexRange> ranges;
+    ranges.reserve((count + BlockSize - 1) / BlockSize);
+    for (int begin = 0; begin < count; begin += BlockSize)
+        ranges += IndexRange{begin, qMin(begin + BlockSize, count)};
+    QtConcurrent::blockingMap(ranges, [&function](IndexRange &range) {
+        function(range.begin, range.end);
+    });
+}
+
+// a counting sort of the corners by vertex, which keeps them in face order
+VertexAdjacency VertexAdjacency::fromFaces(const QVector<unsigned int>& faces, int vertexCount)
+{
+    VertexAdjacency adjacency;
+    adjacency.starts.fill(0, vertexCount + 1);
+    for (unsigned int vertex : faces)
+        ++adjacency.starts[vertex + 1];
+    for (int i = 0; i < vertexCount; ++i)
+        adjacency.starts[i + 1] += adjacency.starts[i];
+
+    QVector<int> next = adjacency.starts;
+    adjacency.corners.resize(faces.size());
+    for (int corner = 0; corner < faces.size(); ++corner)
+        adjacency.corners[next[faces.at(corner)]++] = corner;
+    return adjacency;
+}
+
 BaseGeometryLoader::BaseGeometryLoader()
     : m_loadTextureCoords(true)
     , m_generateTangents(true)
     , m_centerMesh(false)
+    , m_quantizeVertices(false)
+    , m_angleWeightedNormals(false)
+    , m_weldTolerance(-1.0f)
+    , m_weldAttributes(true)
+    , m_optimizeVertexCache(false)
     , m_geometry(nullptr)
 {
 }
@@ -67,87 +150,214 @@ QGeometry *BaseGeometryLoader::geometry() const
 
 bool BaseGeometryLoader::load(QIODevice *ioDev, const QString &subMesh)
 {
-    if (!doLoad(ioDev, subMesh))
+    if (!doLoad(ioDev, parseOptions(subMesh)))
         return false;
 
+    if (m_weldTolerance >= 0.0f)
+        weldVertices();
+
+    // the adjacency is shared by the generation of normals and tangents, and
+    // the reordering of the triangles
+    const bool tangentsNeeded = m_generateTangents && !m_texCoords.isEmpty();
+    VertexAdjacency adjacency;
+    if (m_normals.isEmpty() || tangentsNeeded || m_optimizeVertexCache)
+        adjacency = VertexAdjacency::fromFaces(m_indices, m_points.size());
+
     if (m_normals.isEmpty())
-        generateAveragedNormals(m_points, m_normals, m_indices);
+        generateAveragedNormals(m_points, m_normals, m_indices, adjacency);
 
-    if (m_generateTangents && !m_texCoords.isEmpty())
-        generateTangents(m_points, m_normals, m_indices, m_texCoords, m_tangents);
+    if (tangentsNeeded)
+        generateTangents(m_points, m_normals, m_indices, m_texCoords, adjacency, m_tangents);
 
     if (m_centerMesh)
         center(m_points);
 
+    if (m_optimizeVertexCache)
+        optimizeVertexCache(adjacency);
+
+    if (!m_lodRatios.isEmpty())
+        m_lodIndices = MeshSimplifier(m_points, m_indices).simplify(m_lodRatios);
+
     qCDebug(BaseGeometryLoaderLog) << "Loaded mesh:";
     qCDebug(BaseGeometryLoaderLog) << " " << m_points.size() << "points";
     qCDebug(BaseGeometryLoaderLog) << " " << m_indices.size() / 3 << "triangles.";
     qCDebug(BaseGeometryLoaderLog) << " " << m_normals.size() << "normals";
     qCDebug(BaseGeometryLoaderLog) << " " << m_tangents.size() << "tangents ";
     qCDebug(BaseGeometryLoaderLog) << " " << m_texCoords.size() << "texture coordinates.";
+    for (int i = 0; i < m_lodIndices.size(); ++i)
+        qCDebug(BaseGeometryLoaderLog) << " " << m_lodIndices.at(i).size() / 3 << "triangles at level of detail" << i + 1;
 
     generateGeometry();
 
     return true;
 }
 
+// the ratios between 0 and 1 of a comma separated list, largest first
+static QVector<float> parseRatios(const QString &value)
+{
+    QVector<float> ratios;
+    const QStringList parts = value.split(QLatin1Char(','), QString::SkipEmptyParts);
+    for (const QString &part : parts) {
+        bool ok = false;
+        const float ratio = part.toFloat(&ok);
+        if (ok && ratio > 0.0f && ratio < 1.0f)
+            ratios += ratio;
+    }
+    std::sort(ratios.begin(), ratios.end(), std::greater<float>());
+    return ratios;
+}
+
+// Picks the generic options from a semicolon separated sub-mesh string, and
+// returns the rest for doLoad():
+// - compact: see VertexQuantizer
+// - normals=angle: weight the face normals by the angle of each corner when
+//   generating normals, so that they do not depend on the triangulation
+// - weld[=<tolerance>]: merge the vertices at the same position (mm), see
+//   weldVertices()
+// - weldpositions: with weld, merge vertices at the same position even if
+//   their normals or texture coordinates differ
+// - optimize: reorder the triangles and vertices for the vertex caches, see
+//   optimizeVertexCache()
+// - lods=<ratio>[,<ratio>...]: simplify the mesh to the given ratios of its
+//   triangles, e.g. "lods=0.5,0.1", see MeshSimplifier
+QString BaseGeometryLoader::parseOptions(const QString &subMesh)
+{
+    QStringList remaining;
+    const QStringList options = subMesh.split(QLatin1Char(';'), QString::SkipEmptyParts);
+    for (const QString &option : options) {
+        const int index = option.indexOf(QLatin1Char('='));
+        const QString key = option.left(index).trimmed();
+        const QString value = index == -1 ? QString() : option.mid(index + 1).trimmed();
+        if (key == QLatin1String("compact") && index == -1)
+            m_quantizeVertices = true;
+        else if (key == QLatin1String("normals") && value == QLatin1String("angle"))
+            m_angleWeightedNormals = true;
+        else if (key == QLatin1String("weld"))
+            m_weldTolerance = value.isEmpty() ? DefaultWeldTolerance : qMax(0.0f, value.toFloat());
+        else if (key == QLatin1String("weldpositions") && index == -1)
+            m_weldAttributes = false;
+        else if (key == QLatin1String("optimize") && index == -1)
+            m_optimizeVertexCache = true;
+        else if (key == QLatin1String("lods"))
+            m_lodRatios = parseRatios(value);
+        else
+            remaining += option;
+    }
+    return remaining.join(QLatin1Char(';'));
+}
+
 void BaseGeometryLoader::generateAveragedNormals(const QVector<QVector3D>& points,
                                                  QVector<QVector3D>& normals,
                                                  const QVector<unsigned int>& faces) const
 {
-    for (int i = 0; i < points.size(); ++i)
-        normals.append(QVector3D());
-
-    for (int i = 0; i < faces.size(); i += 3) {
-        const QVector3D &p1 = points[ faces[i]   ];
-        const QVector3D &p2 = points[ faces[i+1] ];
-        const QVector3D &p3 = points[ faces[i+2] ];
-
-        const QVector3D a = p2 - p1;
-        const QVector3D b = p3 - p1;
-        const QVector3D n = QVector3D::crossProduct(a, b).normalized();
+    generateAveragedNormals(points, normals, faces, VertexAdjacency::fromFaces(faces, points.size()));
+}
 
-        normals[ faces[i]   ] += n;
-        normals[ faces[i+1] ] += n;
-        normals[ faces[i+2] ] += n;
-    }
+// the angle between the edges of a face at a corner
+static float cornerAngle(const QVector<QVector3D>& points, const QVector<unsigned int>& faces, int corner)
+{
+    const int face = corner - corner % 3;
+    const QVector3D &p = points[ faces[corner] ];
+    const QVector3D a = (points[ faces[face + (corner + 1) % 3] ] - p).normalized();
+    const QVector3D b = (points[ faces[face + (corner + 2) % 3] ] - p).normalized();
+    return std::acos(qBound(-1.0f, QVector3D::dotProduct(a, b), 1.0f));
+}
 
-    for (int i = 0; i < normals.size(); ++i)
-        normals[i].normalize();
+// The face normals are computed in parallel, and then each vertex sums the
+// normals of its faces in face order, also in parallel. The sums are the
+// same as a serial scatter over the faces, whatever the number of threads.
+void BaseGeometryLoader::generateAveragedNormals(const QVector<QVector3D>& points,
+                                                 QVector<QVector3D>& normals,
+                                                 const QVector<unsigned int>& faces,
+                                                 const VertexAdjacency& adjacency) const
+{
+    QVector<QVector3D> faceNormals(faces.size() / 3);
+    QVector3D *faceNormalData = faceNormals.data();
+    blockingForRanges(faceNormals.size(), [&](int begin, int end) {
+        for (int face = begin; face < end; ++face) {
+            const QVector3D &p1 = points[ faces[3 * face]     ];
+            const QVector3D &p2 = points[ faces[3 * face + 1] ];
+            const QVector3D &p3 = points[ faces[3 * face + 2] ];
+
+            const QVector3D a = p2 - p1;
+            const QVector3D b = p3 - p1;
+            faceNormalData[face] = QVector3D::crossProduct(a, b).normalized();
+        }
+    });
+
+    const bool angleWeighted = m_angleWeightedNormals;
+    normals.resize(points.size());
+    QVector3D *normalData = normals.data();
+    blockingForRanges(normals.size(), [&](int begin, int end) {
+        for (int vertex = begin; vertex < end; ++vertex) {
+            QVector3D n;
+            for (int i = adjacency.starts[vertex]; i < adjacency.starts[vertex + 1]; ++i) {
+                const int corner = adjacency.corners[i];
+                if (angleWeighted)
+                    n += cornerAngle(points, faces, corner) * faceNormalData[corner / 3];
+                else
+                    n += faceNormalData[corner / 3];
+            }
+            n.normalize();
+            normalData[vertex] = n;
+        }
+    });
 }
 
 void BaseGeometryLoader::generateGeometry()
 {
     QByteArray bufferBytes;
     const int count = m_points.size();
-    const quint32 elementSize = 3 + (hasTextureCoordinates() ? 2 : 0)
-            + (hasNormals() ? 3 : 0)
-            + (hasTangents() ? 4 : 0);
-    const quint32 stride = elementSize * sizeof(float);
+    const quint32 positionSize = m_quantizeVertices ? 4 * sizeof(quint16) : 3 * sizeof(float);
+    const quint32 normalSize = m_quantizeVertices ? 2 * sizeof(qint16) : 3 * sizeof(float);
+    const quint32 stride = positionSize + (hasTextureCoordinates() ? 2 * sizeof(float) : 0)
+            + (hasNormals() ? normalSize : 0)
+            + (hasTangents() ? 4 * sizeof(float) : 0);
     bufferBytes.resize(stride * count);
-    float *fptr = reinterpret_cast<float*>(bufferBytes.data());
+    char *ptr = bufferBytes.data();
+
+    const VertexQuantizer quantizer = m_quantizeVertices ? VertexQuantizer::fromPoints(m_points.cbegin(), m_points.cend())
+                                                         : VertexQuantizer(QVector3D(), QVector3D());
 
     for (int index = 0; index < count; ++index) {
-        *fptr++ = m_points.at(index).x();
-        *fptr++ = m_points.at(index).y();
-        *fptr++ = m_points.at(index).z();
+        if (m_quantizeVertices) {
+            quantizer.quantizePosition(m_points.at(index), reinterpret_cast<quint16*>(ptr));
+            ptr += positionSize;
+        } else {
+            float *fptr = reinterpret_cast<float*>(ptr);
+            *fptr++ = m_points.at(index).x();
+            *fptr++ = m_points.at(index).y();
+            *fptr++ = m_points.at(index).z();
+            ptr = reinterpret_cast<char*>(fptr);
+        }
 
         if (hasTextureCoordinates()) {
+            float *fptr = reinterpret_cast<float*>(ptr);
             *fptr++ = m_texCoords.at(index).x();
             *fptr++ = m_texCoords.at(index).y();
+            ptr = reinterpret_cast<char*>(fptr);
         }
 
         if (hasNormals()) {
-            *fptr++ = m_normals.at(index).x();
-            *fptr++ = m_normals.at(index).y();
-            *fptr++ = m_normals.at(index).z();
+            if (m_quantizeVertices) {
+                VertexQuantizer::octahedralEncode(m_normals.at(index), reinterpret_cast<qint16*>(ptr));
+                ptr += normalSize;
+            } else {
+                float *fptr = reinterpret_cast<float*>(ptr);
+                *fptr++ = m_normals.at(index).x();
+                *fptr++ = m_normals.at(index).y();
+                *fptr++ = m_normals.at(index).z();
+                ptr = reinterpret_cast<char*>(fptr);
+            }
         }
 
         if (hasTangents()) {
+            float *fptr = reinterpret_cast<float*>(ptr);
             *fptr++ = m_tangents.at(index).x();
             *fptr++ = m_tangents.at(index).y();
             *fptr++ = m_tangents.at(index).z();
             *fptr++ = m_tangents.at(index).w();
+            ptr = reinterpret_cast<char*>(fptr);
         }
     } // of buffer filling loop
 
@@ -158,9 +368,14 @@ void BaseGeometryLoader::generateGeometry()
         qDebug(BaseGeometryLoaderLog, "Existing geometry instance getting overridden.");
     m_geometry = new QGeometry();
 
-    QAttribute *positionAttribute = new QAttribute(buf, QAttribute::defaultPositionAttributeName(), QAttribute::Float, 3, count, 0, stride);
+    QAttribute *positionAttribute = new QAttribute(buf, QAttribute::defaultPositionAttributeName(),
+                                                   m_quantizeVertices ? QAttribute::UnsignedShort : QAttribute::Float, 3, count, 0, stride);
     m_geometry->addAttribute(positionAttribute);
-    quint32 offset = sizeof(float) * 3;
+    quint32 offset = positionSize;
+
+    // maps the normalized compact positions back to model space
+    if (m_quantizeVertices)
+        m_geometry->setProperty("positionTransform", QVariant::fromValue(quantizer.transform()));
 
     if (hasTextureCoordinates()) {
         QAttribute *texCoordAttribute = new QAttribute(buf, QAttribute::defaultTextureCoordinateAttributeName(),  QAttribute::Float, 2, count, offset, stride);
@@ -169,9 +384,11 @@ void BaseGeometryLoader::generateGeometry()
     }
 
     if (hasNormals()) {
-        QAttribute *normalAttribute = new QAttribute(buf, QAttribute::defaultNormalAttributeName(), QAttribute::Float, 3, count, offset, stride);
+        QAttribute *normalAttribute = m_quantizeVertices
+                ? new QAttribute(buf, VertexQuantizer::octahedralNormalAttributeName(), QAttribute::Short, 2, count, offset, stride)
+                : new QAttribute(buf, QAttribute::defaultNormalAttributeName(), QAttribute::Float, 3, count, offset, stride);
         m_geometry->addAttribute(normalAttribute);
-        offset += sizeof(float) * 3;
+        offset += normalSize;
     }
 
     if (hasTangents()) {
@@ -180,21 +397,39 @@ void BaseGeometryLoader::generateGeometry()
         offset += sizeof(float) * 4;
     }
 
+    // the levels of detail follow the full mesh in the same index buffer, and
+    // are drawn by adjusting indexOffset and vertexCount of the geometry
+    // renderer
+    QVector<unsigned int> indices = m_indices;
+    QVariantList levelsOfDetail;
+    for (int i = -1; i < m_lodIndices.size(); ++i) {
+        const QVector<unsigned int> &lodIndices = i < 0 ? m_indices : m_lodIndices.at(i);
+        QVariantMap level;
+        level.insert(QStringLiteral("ratio"), i < 0 ? 1.0f : m_lodRatios.at(i));
+        level.insert(QStringLiteral("first"), i < 0 ? 0 : indices.size());
+        level.insert(QStringLiteral("count"), lodIndices.size());
+        levelsOfDetail += level;
+        if (i >= 0)
+            indices += lodIndices;
+    }
+    if (!m_lodIndices.isEmpty())
+        m_geometry->setProperty("levelsOfDetail", levelsOfDetail);
+
     QByteArray indexBytes;
     QAttribute::VertexBaseType ty;
-    if (m_indices.size() < 65536) {
+    if (indices.size() < 65536) {
         // we can use USHORT
         ty = QAttribute::UnsignedShort;
-        indexBytes.resize(m_indices.size() * sizeof(quint16));
+        indexBytes.resize(indices.size() * sizeof(quint16));
         quint16 *usptr = reinterpret_cast<quint16*>(indexBytes.data());
-        for (int i = 0; i < m_indices.size(); ++i)
-            *usptr++ = static_cast<quint16>(m_indices.at(i));
+        for (int i = 0; i < indices.size(); ++i)
+            *usptr++ = static_cast<quint16>(indices.at(i));
     } else {
         // use UINT - no conversion needed, but let's ensure int is 32-bit!
         ty = QAttribute::UnsignedInt;
         Q_ASSERT(sizeof(int) == sizeof(quint32));
-        indexBytes.resize(m_indices.size() * sizeof(quint32));
-        memcpy(indexBytes.data(), reinterpret_cast<const char*>(m_indices.data()), indexBytes.size());
+        indexBytes.resize(indices.size() * sizeof(quint32));
+        memcpy(indexBytes.data(), reinterpret_cast<const char*>(indices.data()), indexBytes.size());
     }
 
     QBuffer *indexBuffer = new QBuffer();
@@ -210,54 +445,108 @@ void BaseGeometryLoader::generateTangents(const QVector<QVector3D>& points,
                                           const QVector<QVector2D>& texCoords,
                                           QVector<QVector4D>& tangents) const
 {
-    tangents.clear();
-    QVector<QVector3D> tan1Accum;
-    QVector<QVector3D> tan2Accum;
-
-    tan1Accum.resize(points.size());
-    tan2Accum.resize(points.size());
-    tangents.resize(points.size());
+    generateTangents(points, normals, faces, texCoords, VertexAdjacency::fromFaces(faces, points.size()), tangents);
+}
 
-    // Compute the tangent vector
-    for (int i = 0; i < faces.size(); i += 3) {
-        const QVector3D &p1 = points[ faces[i] ];
-        const QVector3D &p2 = points[ faces[i+1] ];
-        const QVector3D &p3 = points[ faces[i+2] ];
-
-        const QVector2D &tc1 = texCoords[ faces[i] ];
-        const QVector2D &tc2 = texCoords[ faces[i+1] ];
-        const QVector2D &tc3 = texCoords[ faces[i+2] ];
-
-        const QVector3D q1 = p2 - p1;
-        const QVector3D q2 = p3 - p1;
-        const float s1 = tc2.x() - tc1.x(), s2 = tc3.x() - tc1.x();
-        const float t1 = tc2.y() - tc1.y(), t2 = tc3.y() - tc1.y();
-        const float r = 1.0f / (s1 * t2 - s2 * t1);
-        const QVector3D tan1((t2 * q1.x() - t1 * q2.x()) * r,
-                             (t2 * q1.y() - t1 * q2.y()) * r,
-                             (t2 * q1.z() - t1 * q2.z()) * r);
-        const QVector3D tan2((s1 * q2.x() - s2 * q1.x()) * r,
-                             (s1 * q2.y() - s2 * q1.y()) * r,
-                             (s1 * q2.z() - s2 * q1.z()) * r);
-        tan1Accum[ faces[i]   ] += tan1;
-        tan1Accum[ faces[i+1] ] += tan1;
-        tan1Accum[ faces[i+2] ] += tan1;
-        tan2Accum[ faces[i]   ] += tan2;
-        tan2Accum[ faces[i+1] ] += tan2;
-        tan2Accum[ faces[i+2] ] += tan2;
+// Gram-Schmidt orthogonalizes the summed tangents t against the normals n,
+// and stores the handedness of the bitangents b in w. The components are in
+// separate arrays and the loop has no branches, so that it vectorizes (see
+// amf.pro).
+static void orthogonalizeTangents(int count, const float *nx, const float *ny, const float *nz,
+                                  const float *tx, const float *ty, const float *tz,
+                                  const float *bx, const float *by, const float *bz, float *tangents)
+{
+    for (int i = 0; i < count; ++i) {
+        const float d = nx[i] * tx[i] + ny[i] * ty[i] + nz[i] * tz[i];
+        const float ox = tx[i] - d * nx[i];
+        const float oy = ty[i] - d * ny[i];
+        const float oz = tz[i] - d * nz[i];
+        // a null vector stays null
+        const float scale = 1.0f / std::sqrt(ox * ox + oy * oy + oz * oz + FLT_MIN);
+
+        const float cx = ny[i] * tz[i] - nz[i] * ty[i];
+        const float cy = nz[i] * tx[i] - nx[i] * tz[i];
+        const float cz = nx[i] * ty[i] - ny[i] * tx[i];
+        const float handedness = cx * bx[i] + cy * by[i] + cz * bz[i];
+
+        tangents[4 * i]     = ox * scale;
+        tangents[4 * i + 1] = oy * scale;
+        tangents[4 * i + 2] = oz * scale;
+        tangents[4 * i + 3] = handedness < 0.0f ? -1.0f : 1.0f;
     }
+}
 
-    for (int i = 0; i < points.size(); ++i) {
-        const QVector3D &n = normals[i];
-        const QVector3D &t1 = tan1Accum[i];
-        const QVector3D &t2 = tan2Accum[i];
+// The tangents and bitangents of the faces are computed in parallel, into
+// one array per component. Each block of vertices then gathers the sums of
+// its faces through the adjacency in face order, like a serial scatter would,
+// and orthogonalizes them against the normals.
+void BaseGeometryLoader::generateTangents(const QVector<QVector3D>& points,
+                                          const QVector<QVector3D>& normals,
+                                          const QVector<unsigned int>& faces,
+                                          const QVector<QVector2D>& texCoords,
+                                          const VertexAdjacency& adjacency,
+                                          QVector<QVector4D>& tangents) const
+{
+    const int faceCount = faces.size() / 3;
+    QVector<float> faceTangents(6 * faceCount);
+    float *faceComponents[6];
+    for (int component = 0; component < 6; ++component)
+        faceComponents[component] = faceTangents.data() + component * faceCount;
+
+    blockingForRanges(faceCount, [&](int begin, int end) {
+        for (int face = begin; face < end; ++face) {
+            const QVector3D &p1 = points[ faces[3 * face]     ];
+            const QVector3D &p2 = points[ faces[3 * face + 1] ];
+            const QVector3D &p3 = points[ faces[3 * face + 2] ];
+
+            const QVector2D &tc1 = texCoords[ faces[3 * face]     ];
+            const QVector2D &tc2 = texCoords[ faces[3 * face + 1] ];
+            const QVector2D &tc3 = texCoords[ faces[3 * face + 2] ];
+
+            const QVector3D q1 = p2 - p1;
+            const QVector3D q2 = p3 - p1;
+            const float s1 = tc2.x() - tc1.x(), s2 = tc3.x() - tc1.x();
+            const float t1 = tc2.y() - tc1.y(), t2 = tc3.y() - tc1.y();
+            const float r = 1.0f / (s1 * t2 - s2 * t1);
+            faceComponents[0][face] = (t2 * q1.x() - t1 * q2.x()) * r;
+            faceComponents[1][face] = (t2 * q1.y() - t1 * q2.y()) * r;
+            faceComponents[2][face] = (t2 * q1.z() - t1 * q2.z()) * r;
+            faceComponents[3][face] = (s1 * q2.x() - s2 * q1.x()) * r;
+            faceComponents[4][face] = (s1 * q2.y() - s2 * q1.y()) * r;
+            faceComponents[5][face] = (s1 * q2.z() - s2 * q1.z()) * r;
+        }
+    });
 
-        // Gram-Schmidt orthogonalize
-        tangents[i] = QVector4D(QVector3D(t1 - QVector3D::dotProduct(n, t1) * n).normalized(), 0.0f);
+    tangents.resize(points.size());
+    float *tangentData = reinterpret_cast<float *>(tangents.data());
+    blockingForRanges(points.size(), [&](int begin, int end) {
+        // the normals, the summed tangents and the summed bitangents
+        const int count = end - begin;
+        QVector<float> vertexData(9 * count);
+        float *vertexComponents[9];
+        for (int component = 0; component < 9; ++component)
+            vertexComponents[component] = vertexData.data() + component * count;
+
+        for (int i = 0; i < count; ++i) {
+            const int vertex = begin + i;
+            vertexComponents[0][i] = normals[vertex].x();
+            vertexComponents[1][i] = normals[vertex].y();
+            vertexComponents[2][i] = normals[vertex].z();
+            float sums[6] = { 0, 0, 0, 0, 0, 0 };
+            for (int j = adjacency.starts[vertex]; j < adjacency.starts[vertex + 1]; ++j) {
+                const int face = adjacency.corners[j] / 3;
+                for (int component = 0; component < 6; ++component)
+                    sums[component] += faceComponents[component][face];
+            }
+            for (int component = 0; component < 6; ++component)
+                vertexComponents[3 + component][i] = sums[component];
+        }
 
-        // Store handedness in w
-        tangents[i].setW((QVector3D::dotProduct(QVector3D::crossProduct(n, t1), t2) < 0.0f) ? -1.0f : 1.0f);
-    }
+        orthogonalizeTangents(count, vertexComponents[0], vertexComponents[1], vertexComponents[2],
+                              vertexComponents[3], vertexComponents[4], vertexComponents[5],
+                              vertexComponents[6], vertexComponents[7], vertexComponents[8],
+                              tangentData + 4 * begin);
+    });
 }
 
 void BaseGeometryLoader::center(QVector<QVector3D>& points)
@@ -275,6 +564,298 @@ void BaseGeometryLoader::center(QVector<QVector3D>& points)
     }
 }
 
+// the position of a vertex rounded to a multiple of the weld tolerance
+struct WeldKey
+{
+    qint64 x;
+    qint64 y;
+    qint64 z;
+
+    bool operator==(const WeldKey &other) const
+    {
+        return x == other.x && y == other.y && z == other.z;
+    }
+};
+
+static uint qHash(const WeldKey &key, uint seed = 0)
+{
+    return qHash(key.x, seed) ^ qHash(key.y, seed * 31 + 1) ^ qHash(key.z, seed * 97 + 2);
+}
+
+static qint64 weldCoordinate(float value, double scale)
+{
+    return qRound64(value * scale);
+}
+
+// Merges the vertices whose positions round to the same multiple of the
+// weld tolerance, and, unless only positions are welded, that have the same
+// normals and texture coordinates. Loaders like Assimp's AMF importer give
+// each triangle its own vertices, which makes the buffers three times larger
+// and the generated normals faceted.
+//
+// The vertices are distributed to buckets by the hash of their rounded
+// positions, and the buckets are welded in parallel. Each vertex is merged
+// into the first vertex with the same key, so the result does not depend on
+// the number of threads. The merged vertices keep the position and the
+// attributes of the first one, and the triangles that collapse are removed.
+void BaseGeometryLoader::weldVertices()
+{
+    const int count = m_points.size();
+    if (count == 0)
+        return;
+
+    const bool compareNormals = m_weldAttributes && m_normals.size() == count;
+    const bool compareTexCoords = m_weldAttributes && m_texCoords.size() == count;
+    const double scale = m_weldTolerance > 0.0f ? 1.0 / m_weldTolerance : 1.0;
+    const bool exact = m_weldTolerance <= 0.0f;
+
+    QVector<WeldKey> keys(count);
+    QVector<int> buckets(count);
+    WeldKey *keyData = keys.data();
+    int *bucketData = buckets.data();
+    blockingForRanges(count, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            const QVector3D &point = m_points.at(i);
+            WeldKey key;
+            if (exact) {
+                // the bits of the floats, with -0 as 0
+                float x = point.x() + 0.0f, y = point.y() + 0.0f, z = point.z() + 0.0f;
+                quint32 bits[3];
+                memcpy(&bits[0], &x, sizeof(float));
+                memcpy(&bits[1], &y, sizeof(float));
+                memcpy(&bits[2], &z, sizeof(float));
+                key = WeldKey{bits[0], bits[1], bits[2]};
+            } else {
+                key = WeldKey{weldCoordinate(point.x(), scale), weldCoordinate(point.y(), scale),
+                              weldCoordinate(point.z(), scale)};
+            }
+            keyData[i] = key;
+            bucketData[i] = int(qHash(key) % WeldBucketCount);
+        }
+    });
+
+    // the vertices of each bucket, in order
+    QVector<int> bucketStarts(WeldBucketCount + 1, 0);
+    for (int bucket : buckets)
+        ++bucketStarts[bucket + 1];
+    for (int i = 0; i < WeldBucketCount; ++i)
+        bucketStarts[i + 1] += bucketStarts[i];
+    QVector<int> next = bucketStarts;
+    QVector<int> bucketVertices(count);
+    for (int i = 0; i < count; ++i)
+        bucketVertices[next[buckets.at(i)]++] = i;
+
+    // the first vertex that each vertex is merged into, or itself
+    QVector<int> merged(count);
+    int *mergedData = merged.data();
+    auto weldBucket = [&](int bucket) {
+        QMultiHash<WeldKey, int> firsts;
+        for (int i = bucketStarts.at(bucket); i < bucketStarts.at(bucket + 1); ++i) {
+            const int vertex = bucketVertices.at(i);
+            const WeldKey &key = keys.at(vertex);
+            int first = vertex;
+            for (auto it = firsts.constFind(key); it != firsts.cend() && it.key() == key; ++it) {
+                const int candidate = it.value();
+                if ((!compareNormals || m_normals.at(candidate) == m_normals.at(vertex))
+                        && (!compareTexCoords || m_texCoords.at(candidate) == m_texCoords.at(vertex))) {
+                    first = candidate;
+                    break;
+                }
+            }
+            if (first == vertex)
+                firsts.insert(key, vertex);
+            mergedData[vertex] = first;
+        }
+    };
+
+    // the buckets are far fewer than the items of a block, so that they are
+    // mapped one by one
+    if (count <= BlockSize) {
+        for (int bucket = 0; bucket < WeldBucketCount; ++bucket)
+            weldBucket(bucket);
+    } else {
+        QVector<int> bucketIds(WeldBucketCount);
+        std::iota(bucketIds.begin(), bucketIds.end(), 0);
+        QtConcurrent::blockingMap(bucketIds, [&weldBucket](int bucket) { weldBucket(bucket); });
+    }
+
+    // the first vertices are kept in order
+    QVector<unsigned int> remap(count);
+    int welded = 0;
+    for (int i = 0; i < count; ++i) {
+        if (merged.at(i) == i) {
+            remap[i] = welded;
+            m_points[welded] = m_points.at(i);
+            if (m_normals.size() == count)
+                m_normals[welded] = m_normals.at(i);
+            if (m_texCoords.size() == count)
+                m_texCoords[welded] = m_texCoords.at(i);
+            ++welded;
+        } else {
+            remap[i] = remap.at(merged.at(i));
+        }
+    }
+    m_points.resize(welded);
+    if (m_normals.size() == count)
+        m_normals.resize(welded);
+    if (m_texCoords.size() == count)
+        m_texCoords.resize(welded);
+
+    unsigned int *indexData = m_indices.data();
+    blockingForRanges(m_indices.size(), [&](int begin, int end) {
+        for (int i = begin; i < end; ++i)
+            indexData[i] = remap.at(indexData[i]);
+    });
+
+    int kept = 0;
+    for (int i = 0; i + 2 < m_indices.size(); i += 3) {
+        const unsigned int a = m_indices.at(i), b = m_indices.at(i + 1), c = m_indices.at(i + 2);
+        if (a == b || b == c || c == a)
+            continue;
+        m_indices[kept++] = a;
+        m_indices[kept++] = b;
+        m_indices[kept++] = c;
+    }
+    const int collapsed = (m_indices.size() - kept) / 3;
+    m_indices.resize(kept);
+
+    qCDebug(BaseGeometryLoaderLog) << "Welded" << count << "vertices into" << welded
+                                   << "and removed" << collapsed << "collapsed triangles";
+}
+
+// the average cache miss ratio (vertex shader invocations per triangle) of
+// a FIFO post-transform cache, from 0.5 to 3
+static float averageCacheMissRatio(const QVector<unsigned int>& indices, int vertexCount)
+{
+    if (indices.size() < 3)
+        return 0.0f;
+
+    // a vertex is cached if fewer than VertexCacheSize misses happened since
+    // it was added
+    QVector<int> added(vertexCount, -VertexCacheSize);
+    int misses = 0;
+    for (unsigned int vertex : indices) {
+        if (misses - added.at(vertex) >= VertexCacheSize)
+            added[vertex] = misses++;
+    }
+    return float(misses) / (indices.size() / 3);
+}
+
+// the next vertex to fan around: the vertex of the last triangles that
+// stays in the cache the longest, or that was cached most recently when its
+// remaining triangles are emitted, else the last vertex of the dead-end
+// stack with triangles left, else the next vertex in order
+static int nextFanningVertex(const QVector<int>& candidates, const QVector<int>& liveTriangles,
+                             const QVector<int>& cacheTime, int time, QVector<int>& deadEnds, int& cursor)
+{
+    int next = -1;
+    int best = -1;
+    for (int vertex : candidates) {
+        if (liveTriangles.at(vertex) <= 0)
+            continue;
+        int priority = 0;
+        if (time - cacheTime.at(vertex) + 2 * liveTriangles.at(vertex) <= VertexCacheSize)
+            priority = time - cacheTime.at(vertex);
+        if (priority > best) {
+            best = priority;
+            next = vertex;
+        }
+    }
+    if (next != -1)
+        return next;
+
+    while (!deadEnds.isEmpty()) {
+        const int vertex = deadEnds.takeLast();
+        if (liveTriangles.at(vertex) > 0)
+            return vertex;
+    }
+    for (; cursor < liveTriangles.size(); ++cursor) {
+        if (liveTriangles.at(cursor) > 0)
+            return cursor++;
+    }
+    return -1;
+}
+
+// Reorders the triangles with Tipsify (Sander, Nehab and Barczak, "Fast
+// Triangle Reordering for Vertex Locality and Reduced Overdraw", 2007): the
+// triangles are emitted in fans around a vertex, and the next vertex is one
+// of the vertices just emitted that is still in the cache. It runs in linear
+// time, unlike Forsyth's scoring, which matters for meshes of millions of
+// triangles.
+//
+// The vertices are then renumbered in the order of their first use, so that
+// the vertex fetches read the buffer mostly in order. The ACMR before and
+// after is logged.
+void BaseGeometryLoader::optimizeVertexCache(const VertexAdjacency& adjacency)
+{
+    const int vertexCount = m_points.size();
+    const int faceCount = m_indices.size() / 3;
+    if (faceCount == 0)
+        return;
+
+    const float acmrBefore = averageCacheMissRatio(m_indices, vertexCount);
+
+    QVector<int> liveTriangles(vertexCount);
+    for (int vertex = 0; vertex < vertexCount; ++vertex)
+        liveTriangles[vertex] = adjacency.starts.at(vertex + 1) - adjacency.starts.at(vertex);
+
+    QVector<unsigned int> indices;
+    indices.reserve(3 * faceCount);
+    QVector<bool> emitted(faceCount, false);
+    QVector<int> cacheTime(vertexCount, 0);
+    QVector<int> deadEnds;
+    QVector<int> candidates;
+    int time = VertexCacheSize + 1;
+    int cursor = 0;
+    int vertex = nextFanningVertex(candidates, liveTriangles, cacheTime, time, deadEnds, cursor);
+    while (vertex >= 0) {
+        candidates.clear();
+        for (int i = adjacency.starts.at(vertex); i < adjacency.starts.at(vertex + 1); ++i) {
+            const int face = adjacency.corners.at(i) / 3;
+            if (face == faceCount || emitted.at(face))
+                continue;
+            emitted[face] = true;
+            for (int corner = 3 * face; corner < 3 * face + 3; ++corner) {
+                const unsigned int v = m_indices.at(corner);
+                indices += v;
+                deadEnds += v;
+                candidates += v;
+                --liveTriangles[v];
+                if (time - cacheTime.at(v) > VertexCacheSize)
+                    cacheTime[v] = time++;
+            }
+        }
+        vertex = nextFanningVertex(candidates, liveTriangles, cacheTime, time, deadEnds, cursor);
+    }
+    // a trailing partial triangle is kept
+    for (int i = 3 * faceCount; i < m_indices.size(); ++i)
+        indices += m_indices.at(i);
+    m_indices = indices;
+
+    // renumbers the vertices in the order of first use, the unused ones last
+    QVector<int> order(vertexCount, -1);
+    int next = 0;
+    for (unsigned int &index : m_indices) {
+        if (order.at(index) < 0)
+            order[index] = next++;
+        index = order.at(index);
+    }
+    for (int v = 0; v < vertexCount; ++v) {
+        if (order.at(v) < 0)
+            order[v] = next++;
+    }
+    reorder(m_points, order);
+    if (m_normals.size() == vertexCount)
+        reorder(m_normals, order);
+    if (m_texCoords.size() == vertexCount)
+        reorder(m_texCoords, order);
+    if (m_tangents.size() == vertexCount)
+        reorder(m_tangents, order);
+
+    qCDebug(BaseGeometryLoaderLog) << "Reordered" << faceCount << "triangles, ACMR" << acmrBefore
+                                   << "->" << averageCacheMissRatio(m_indices, vertexCount);
+}
+
 } // namespace Qt3DRender
 
 QT_END_NAMESPACE
@@ -71,6 +71,16 @@ namespace Qt3DRender {
 
 class QGeometry;
 
+// the corners (3 * face + corner) around each vertex, in the order of the
+// faces, so that per-vertex sums can be gathered in parallel without atomics
+struct VertexAdjacency
+{
+    QVector<int> starts; // first corner of each vertex, and the corner count
+    QVector<int> corners;
+
+    static VertexAdjacency fromFaces(const QVector<unsigned int>& faces, int vertexCount);
+};
+
 class BaseGeometryLoader : public QGeometryLoaderInterface
 {
     Q_OBJECT
@@ -86,6 +96,26 @@ public:
     void setMeshCenteringEnabled(bool b) { m_centerMesh = b; }
     bool isMeshCenteringEnabled() const { return m_centerMesh; }
 
+    void setVertexQuantizationEnabled(bool b) { m_quantizeVertices = b; }
+    bool isVertexQuantizationEnabled() const { return m_quantizeVertices; }
+
+    void setAngleWeightedNormalsEnabled(bool b) { m_angleWeightedNormals = b; }
+    bool isAngleWeightedNormalsEnabled() const { return m_angleWeightedNormals; }
+
+    // negative to keep all vertices
+    void setWeldTolerance(float tolerance) { m_weldTolerance = tolerance; }
+    float weldTolerance() const { return m_weldTolerance; }
+
+    void setWeldAttributesEnabled(bool b) { m_weldAttributes = b; }
+    bool isWeldAttributesEnabled() const { return m_weldAttributes; }
+
+    void setVertexCacheOptimizationEnabled(bool b) { m_optimizeVertexCache = b; }
+    bool isVertexCacheOptimizationEnabled() const { return m_optimizeVertexCache; }
+
+    // the ratios of the triangle count of simplified levels of detail
+    void setLevelOfDetailRatios(const QVector<float> &ratios) { m_lodRatios = ratios; }
+    QVector<float> levelOfDetailRatios() const { return m_lodRatios; }
+
     bool hasNormals() const { return !m_normals.isEmpty(); }
     bool hasTextureCoordinates() const { return !m_texCoords.isEmpty(); }
     bool hasTangents() const { return !m_tangents.isEmpty(); }
@@ -95,6 +125,7 @@ public:
     QVector<QVector2D> textureCoordinates() const { return m_texCoords; }
     QVector<QVector4D> tangents() const { return m_tangents; }
     QVector<unsigned int> indices() const { return m_indices; }
+    QVector<QVector<unsigned int>> levelOfDetailIndices() const { return m_lodIndices; }
 
     QGeometry *geometry() const override;
 
@@ -103,26 +134,47 @@ public:
 protected:
     virtual bool doLoad(QIODevice *ioDev, const QString &subMesh = QString()) = 0;
 
+    QString parseOptions(const QString &subMesh);
+
     void generateAveragedNormals(const QVector<QVector3D>& points,
                                  QVector<QVector3D>& normals,
                                  const QVector<unsigned int>& faces) const;
+    void generateAveragedNormals(const QVector<QVector3D>& points,
+                                 QVector<QVector3D>& normals,
+                                 const QVector<unsigned int>& faces,
+                                 const VertexAdjacency& adjacency) const;
     void generateGeometry();
     void generateTangents(const QVector<QVector3D>& points,
                           const QVector<QVector3D>& normals,
                           const QVector<unsigned int>& faces,
                           const QVector<QVector2D>& texCoords,
                           QVector<QVector4D>& tangents) const;
+    void generateTangents(const QVector<QVector3D>& points,
+                          const QVector<QVector3D>& normals,
+                          const QVector<unsigned int>& faces,
+                          const QVector<QVector2D>& texCoords,
+                          const VertexAdjacency& adjacency,
+                          QVector<QVector4D>& tangents) const;
     void center(QVector<QVector3D>& points);
+    void weldVertices();
+    void optimizeVertexCache(const VertexAdjacency& adjacency);
 
     bool m_loadTextureCoords;
     bool m_generateTangents;
     bool m_centerMesh;
+    bool m_quantizeVertices;
+    bool m_angleWeightedNormals;
+    float m_weldTolerance;
+    bool m_weldAttributes;
+    bool m_optimizeVertexCache;
+    QVector<float> m_lodRatios;
 
     QVector<QVector3D> m_points;
     QVector<QVector3D> m_normals;
     QVector<QVector2D> m_texCoords;
     QVector<QVector4D> m_tangents;
     QVector<unsigned int> m_indices;
+    QVector<QVector<unsigned int>> m_lodIndices;
 
     QGeometry *m_geometry;
 };
@@ -0,0 +1,284 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#include "meshsimplifier.h"
+
+#include <QtCore/qpair.h>
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <vector>
+
+// how much more moving the edges of open boundaries costs than moving
+// within the surface
+static const double BoundaryWeight = 100.0;
+
+// the cosine of the largest rotation of a triangle by a collapse, which
+// also rejects the collapses that fold the surface onto itself
+static const float MinNormalCosine = 0.25f;
+
+// the weight of the edge length to the fourth power, the unit of the area
+// weighted squared distances, that prefers shorter edges among equal errors
+static const double EdgeLengthWeight = 1e-6;
+
+void MeshSimplifier::Quadric::addPlane(const QVector3D &normal, const QVector3D &point, double weight)
+{
+    const double x = normal.x(), y = normal.y(), z = normal.z();
+    const double d = -QVector3D::dotProduct(normal, point);
+    const double values[10] = { x * x, x * y, x * z, x * d, y * y, y * z, y * d, z * z, z * d, d * d };
+    for (int i = 0; i < 10; ++i)
+        a[i] += weight * values[i];
+}
+
+void MeshSimplifier::Quadric::add(const Quadric &other)
+{
+    for (int i = 0; i < 10; ++i)
+        a[i] += other.a[i];
+}
+
+// the weighted sum of the squared distances of a point to the planes
+double MeshSimplifier::Quadric::error(const QVector3D &point) const
+{
+    const double x = point.x(), y = point.y(), z = point.z();
+    return a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x
+            + a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+            + a[7] * z * z + 2 * a[8] * z
+            + a[9];
+}
+
+MeshSimplifier::MeshSimplifier(const QVector<QVector3D> &points, const QVector<unsigned int> &indices)
+    : m_points(points),
+      m_indices(indices),
+      m_adjacency(Qt3DRender::VertexAdjacency::fromFaces(indices.size() % 3 ? indices.mid(0, indices.size() / 3 * 3)
+                                                                        : indices, points.size())),
+      m_quadrics(points.size(), Quadric{{0, 0, 0, 0, 0, 0, 0, 0, 0, 0}}),
+      m_alive(indices.size() / 3, 1),
+      m_aliveCount(indices.size() / 3),
+      m_clusterIndices(indices),
+      m_faces(points.size()),
+      m_versions(points.size(), 0),
+      m_flipping(points.size())
+{
+    // the corners of a triangle are next to each other in the adjacency
+    for (int vertex = 0; vertex < points.size(); ++vertex) {
+        QVector<int> &faces = m_faces[vertex];
+        faces.reserve(m_adjacency.starts.at(vertex + 1) - m_adjacency.starts.at(vertex));
+        for (int i = m_adjacency.starts.at(vertex); i < m_adjacency.starts.at(vertex + 1); ++i) {
+            const int face = m_adjacency.corners.at(i) / 3;
+            if (faces.isEmpty() || faces.last() != face)
+                faces += face;
+        }
+    }
+
+    // the planes of the triangles, weighted by area
+    for (int face = 0; face < m_alive.size(); ++face) {
+        const QVector3D &p1 = points.at(indices.at(3 * face));
+        const QVector3D &p2 = points.at(indices.at(3 * face + 1));
+        const QVector3D &p3 = points.at(indices.at(3 * face + 2));
+        const QVector3D normal = QVector3D::crossProduct(p2 - p1, p3 - p1);
+        const float area = normal.length() / 2;
+        if (area <= 0.0f)
+            continue;
+        for (int corner = 3 * face; corner < 3 * face + 3; ++corner)
+            m_quadrics[indices.at(corner)].addPlane(normal.normalized(), p1, area);
+    }
+
+    for (int vertex = 0; vertex < points.size(); ++vertex)
+        addBoundaries(vertex);
+}
+
+// the planes through the edges of a vertex with a single triangle,
+// perpendicular to the triangle
+void MeshSimplifier::addBoundaries(int vertex)
+{
+    QVector<QPair<int, int>> edges; // the other vertex and the triangle
+    for (int i = m_adjacency.starts.at(vertex); i < m_adjacency.starts.at(vertex + 1); ++i) {
+        const int corner = m_adjacency.corners.at(i);
+        const int face = corner / 3;
+        edges += qMakePair(int(m_indices.at(3 * face + (corner + 1) % 3)), face);
+        edges += qMakePair(int(m_indices.at(3 * face + (corner + 2) % 3)), face);
+    }
+    std::sort(edges.begin(), edges.end());
+
+    for (int i = 0; i < edges.size(); ++i) {
+        const int other = edges.at(i).first;
+        const bool single = (i == 0 || edges.at(i - 1).first != other)
+                && (i + 1 == edges.size() || edges.at(i + 1).first != other);
+        if (!single || other <= vertex)
+            continue;
+
+        const int face = edges.at(i).second;
+        const QVector3D &p1 = m_points.at(m_indices.at(3 * face));
+        const QVector3D faceNormal = QVector3D::crossProduct(m_points.at(m_indices.at(3 * face + 1)) - p1,
+                                                             m_points.at(m_indices.at(3 * face + 2)) - p1);
+        const QVector3D edge = m_points.at(other) - m_points.at(vertex);
+        const QVector3D normal = QVector3D::crossProduct(edge, faceNormal).normalized();
+        if (normal.isNull())
+            continue;
+        const double weight = BoundaryWeight * edge.lengthSquared();
+        m_quadrics[vertex].addPlane(normal, m_points.at(vertex), weight);
+        m_quadrics[other].addPlane(normal, m_points.at(vertex), weight);
+    }
+}
+
+// the triangles of a cluster, without the ones removed since
+const QVector<int> &MeshSimplifier::liveFaces(int vertex)
+{
+    QVector<int> &faces = m_faces[vertex];
+    faces.erase(std::remove_if(faces.begin(), faces.end(), [this](int face) { return !m_alive.at(face); }),
+                faces.end());
+    return faces;
+}
+
+// the clusters that share a remaining triangle with a cluster
+QVector<int> MeshSimplifier::neighbors(int vertex)
+{
+    QVector<int> neighbors;
+    for (int face : liveFaces(vertex)) {
+        for (int corner = 3 * face; corner < 3 * face + 3; ++corner) {
+            const int other = m_clusterIndices.at(corner);
+            if (other != vertex)
+                neighbors += other;
+        }
+    }
+    std::sort(neighbors.begin(), neighbors.end());
+    neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+    return neighbors;
+}
+
+// the cheaper direction of collapsing an edge
+MeshSimplifier::Collapse MeshSimplifier::collapse(int u, int v) const
+{
+    Quadric quadric = m_quadrics.at(u);
+    quadric.add(m_quadrics.at(v));
+    const double length = (m_points.at(u) - m_points.at(v)).lengthSquared();
+    const double penalty = EdgeLengthWeight * length * length;
+    const double intoV = quadric.error(m_points.at(v)) + penalty;
+    const double intoU = quadric.error(m_points.at(u)) + penalty;
+    if (intoV <= intoU)
+        return Collapse{intoV, u, v, m_versions.at(u), m_versions.at(v)};
+    return Collapse{intoU, v, u, m_versions.at(v), m_versions.at(u)};
+}
+
+// whether moving a cluster onto another would turn a triangle (nearly) over
+bool MeshSimplifier::flips(int from, int to)
+{
+    const QVector3D &target = m_points.at(to);
+    for (int face : liveFaces(from)) {
+        const unsigned int *vertices = m_clusterIndices.constData() + 3 * face;
+        if (vertices[0] == unsigned(to) || vertices[1] == unsigned(to) || vertices[2] == unsigned(to))
+            continue; // removed by the collapse
+
+        QVector3D before[3];
+        QVector3D after[3];
+        for (int k = 0; k < 3; ++k) {
+            before[k] = m_points.at(vertices[k]);
+            after[k] = vertices[k] == unsigned(from) ? target : before[k];
+        }
+        const QVector3D normalBefore = QVector3D::crossProduct(before[1] - before[0], before[2] - before[0]);
+        const QVector3D normalAfter = QVector3D::crossProduct(after[1] - after[0], after[2] - after[0]);
+        if (QVector3D::dotProduct(normalBefore, normalAfter)
+                <= MinNormalCosine * normalBefore.length() * normalAfter.length())
+            return true;
+    }
+    return false;
+}
+
+// removes the triangles of an edge, and merges a cluster into another
+void MeshSimplifier::merge(int from, int to)
+{
+    QVector<int> moved;
+    for (int face : liveFaces(from)) {
+        unsigned int *vertices = m_clusterIndices.data() + 3 * face;
+        if (vertices[0] == unsigned(to) || vertices[1] == unsigned(to) || vertices[2] == unsigned(to)) {
+            m_alive[face] = 0;
+            --m_aliveCount;
+            continue;
+        }
+        for (int k = 0; k < 3; ++k) {
+            if (vertices[k] == unsigned(from))
+                vertices[k] = to;
+        }
+        moved += face;
+    }
+
+    liveFaces(to);
+    m_faces[to] += moved;
+    m_faces[from] = QVector<int>();
+    m_flipping[from] = QVector<Collapse>();
+    m_quadrics[to].add(m_quadrics.at(from));
+    ++m_versions[from];
+    ++m_versions[to];
+}
+
+QVector<unsigned int> MeshSimplifier::remainingIndices()
+{
+    QVector<unsigned int> indices;
+    indices.reserve(3 * m_aliveCount);
+    for (int face = 0; face < m_alive.size(); ++face) {
+        if (!m_alive.at(face))
+            continue;
+        for (int corner = 3 * face; corner < 3 * face + 3; ++corner)
+            indices += m_clusterIndices.at(corner);
+    }
+    return indices;
+}
+
+QVector<QVector<unsigned int>> MeshSimplifier::simplify(const QVector<float> &ratios)
+{
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> queue;
+    for (int vertex = 0; vertex < m_points.size(); ++vertex) {
+        for (int other : neighbors(vertex)) {
+            if (other > vertex)
+                queue.push(collapse(vertex, other));
+        }
+    }
+
+    QVector<QVector<unsigned int>> levels;
+    const int faceCount = m_alive.size();
+    for (float ratio : ratios) {
+        const int target = qRound(qBound(0.0f, ratio, 1.0f) * faceCount);
+        while (m_aliveCount > target && !queue.empty()) {
+            const Collapse next = queue.top();
+            queue.pop();
+            // skips the edges of clusters that changed since, and keeps the
+            // collapses that would flip a triangle until their triangles change
+            if (m_versions.at(next.from) != next.fromVersion || m_versions.at(next.to) != next.toVersion)
+                continue;
+            if (flips(next.from, next.to)) {
+                m_flipping[next.from] += next;
+                continue;
+            }
+
+            merge(next.from, next.to);
+            m_flipping[next.to].clear();
+            for (int other : neighbors(next.to)) {
+                queue.push(collapse(next.to, other));
+                for (const Collapse &flipping : m_flipping.at(other))
+                    queue.push(flipping);
+                m_flipping[other].clear();
+            }
+        }
+        levels += remainingIndices();
+    }
+    return levels;
+}
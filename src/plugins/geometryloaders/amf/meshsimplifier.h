@@ -0,0 +1,103 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#ifndef MESHSIMPLIFIER_H
+#define MESHSIMPLIFIER_H
+
+#include <QtCore/qvector.h>
+#include <QtGui/qvector3d.h>
+
+#include "basegeometryloader_p.h"
+
+/*
+ * Simplifies a triangle mesh into levels of detail with quadric error
+ * metrics (Garland and Heckbert, "Surface Simplification Using Quadric Error
+ * Metrics", 1997).
+ *
+ * The edge with the smallest error is collapsed repeatedly, and the indices
+ * of the remaining triangles are taken whenever the triangle count reaches
+ * the next level. The edges are collapsed into one of their vertices, so
+ * that all levels index the vertices of the full mesh and share its vertex
+ * buffer. Collapses that would flip a triangle are skipped until the
+ * triangles around them change, shorter edges are preferred among equal
+ * errors so that flat regions are simplified evenly, and the edges of open
+ * boundaries are kept in place by constraint planes.
+ */
+class MeshSimplifier
+{
+public:
+    MeshSimplifier(const QVector<QVector3D> &points, const QVector<unsigned int> &indices);
+
+    // the indices of each level, for ratios of the triangle count in
+    // decreasing order
+    QVector<QVector<unsigned int>> simplify(const QVector<float> &ratios);
+
+private:
+    // a symmetric 4x4 matrix
+    struct Quadric
+    {
+        double a[10];
+
+        void addPlane(const QVector3D &normal, const QVector3D &point, double weight);
+        void add(const Quadric &other);
+        double error(const QVector3D &point) const;
+    };
+
+    struct Collapse
+    {
+        double error;
+        int from;
+        int to;
+        int fromVersion;
+        int toVersion;
+
+        bool operator>(const Collapse &other) const { return error > other.error; }
+    };
+
+    const QVector<int> &liveFaces(int vertex);
+    QVector<int> neighbors(int vertex);
+    Collapse collapse(int u, int v) const;
+    bool flips(int from, int to);
+    void merge(int from, int to);
+    QVector<unsigned int> remainingIndices();
+    void addBoundaries(int vertex);
+
+    const QVector<QVector3D> &m_points;
+    const QVector<unsigned int> &m_indices;
+
+    Qt3DRender::VertexAdjacency m_adjacency;
+
+    QVector<Quadric> m_quadrics;
+    QVector<char> m_alive; // per triangle
+    int m_aliveCount = 0;
+
+    // the vertices are merged into clusters, whose first vertex remains: the
+    // indices refer to the clusters, and each cluster lists its triangles,
+    // which may include triangles removed by the collapses of other clusters
+    QVector<unsigned int> m_clusterIndices;
+    QVector<QVector<int>> m_faces;
+    QVector<int> m_versions;
+
+    // the skipped collapses that would flip a triangle, per collapsed cluster
+    QVector<QVector<Collapse>> m_flipping;
+};
+
+#endif // MESHSIMPLIFIER_H
@@ -1,16 +1,47 @@
 TARGET = gcodegeometryloader
-QT += core-private 3dcore 3dcore-private 3drender 3drender-private
+QT += core-private concurrent 3dcore 3dcore-private 3drender 3drender-private
 
 HEADERS += \
-    gcodegeometryloader.h
+    gcodecache.h \
+    gcodegeometryloader.h \
+    gcodegzipdevice.h \
+    gcodeindex.h \
+    gcodelinemap.h \
+    gcodeparser.h \
+    gcodeprogress.h \
+    gcodesimplifier.h \
+    gcodespatialindex.h \
+    gcodestatistics.h \
+    gcodethumbnailer.h \
+    gcodetravels.h
 
 SOURCES += \
+    gcodecache.cpp \
     gcodegeometryloader.cpp \
-    gcodegeometryloaderplugin.cpp
+    gcodegeometryloaderplugin.cpp \
+    gcodegzipdevice.cpp \
+    gcodeindex.cpp \
+    gcodelinemap.cpp \
+    gcodeparser.cpp \
+    gcodeprogress.cpp \
+    gcodesimplifier.cpp \
+    gcodespatialindex.cpp \
+    gcodestatistics.cpp \
+    gcodethumbnailer.cpp \
+    gcodetravels.cpp
 
 DISTFILES += \
     gcode.json
 
+include(../shared/shared.pri)
+
+QT_FOR_CONFIG += core-private
+qtConfig(system-zlib) {
+    QMAKE_USE_PRIVATE += zlib
+} else {
+    QT_PRIVATE += zlib-private
+}
+
 PLUGIN_TYPE = geometryloaders
 PLUGIN_CLASS_NAME = GcodeGeometryLoaderPlugin
 load(qt_build_config)
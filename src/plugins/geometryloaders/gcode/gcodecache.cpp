@@ -0,0 +1,340 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#include "gcodecache.h"
+
+#include <QtCore/qcache.h>
+#include <QtCore/qcryptographichash.h>
+#include <QtCore/qdatetime.h>
+#include <QtCore/qdir.h>
+#include <QtCore/qfile.h>
+#include <QtCore/qfileinfo.h>
+#include <QtCore/qmutex.h>
+#include <QtCore/qsavefile.h>
+
+#include <algorithm>
+#include <cstring>
+
+static const quint32 CacheMagic = 0x47434143; // "GCAC"
+static const quint32 CacheVersion = 5;
+static const int CacheAlignment = 16;
+static const int HashBlockSize = 64 * 1024;
+static const int MaxCachedBytes = 256 * 1024 * 1024;
+
+enum CacheSection {
+    Layers, Points, Indices, Segments, Travels, LineCheckpoints, LineDeltas, Extrusion, SectionCount
+};
+
+// the optional outputs that were collected
+enum CacheFlag { TravelsFlag = 0x1, LineMapFlag = 0x2 };
+
+// the arrays are stored in the native layout, so the element sizes make sure
+// that a cache is only read by a build that wrote it in the same layout
+static const quint32 ElementSizes[SectionCount] = {
+    sizeof(GcodeLayer), sizeof(QVector3D), sizeof(quint32), sizeof(GcodeSegment), sizeof(QVector3D),
+    sizeof(GcodeLineCheckpoint), sizeof(quint8), sizeof(double)
+};
+
+struct GcodeCacheHeader
+{
+    quint32 magic;
+    quint32 version;
+    qint64 size;
+    qint64 modified;
+    char hash[20];
+    quint32 flags;
+    quint32 elementSizes[SectionCount];
+    qint32 counts[SectionCount];
+    qint64 offsets[SectionCount];
+    double printTime;
+    double travelDistance;
+    double extrusionDistance;
+};
+
+static quint32 toFlags(const GcodeParser &parser)
+{
+    return (parser.travelsEnabled() ? TravelsFlag : 0) | (parser.lineMapEnabled() ? LineMapFlag : 0);
+}
+
+static void setFlags(GcodeParser *parser, quint32 flags)
+{
+    parser->setTravelsEnabled(flags & TravelsFlag);
+    parser->setLineMapEnabled(flags & LineMapFlag);
+}
+
+static qint64 aligned(qint64 offset)
+{
+    return (offset + CacheAlignment - 1) / CacheAlignment * CacheAlignment;
+}
+
+template <typename T>
+static QVector<T> toVector(const uchar *data, const GcodeCacheHeader &header, CacheSection section)
+{
+    QVector<T> vector(header.counts[section]);
+    memcpy(vector.data(), data + header.offsets[section], vector.count() * sizeof(T));
+    return vector;
+}
+
+// the layers start at even indices (segments), and in the order of the
+// indices and travel vertices, which are sliced by layer without checks
+static bool isValid(const QVector<GcodeLayer> &layers, int indexCount, int travelCount)
+{
+    int index = 0;
+    int travel = 0;
+    for (const GcodeLayer &layer : layers) {
+        if (layer.index % 2 || layer.index < index || layer.index > indexCount
+                || layer.travel < travel || layer.travel > travelCount) {
+            return false;
+        }
+        index = layer.index;
+        travel = layer.travel;
+    }
+    return true;
+}
+
+struct GcodeCacheEntry
+{
+    qint64 size;
+    qint64 modified;
+    QVector<GcodeLayer> layers;
+    QVector<QVector3D> points;
+    QVector<quint32> indices;
+    QVector<GcodeSegment> segments;
+    quint32 flags;
+    QVector<QVector3D> travels;
+    GcodeLineMap lineMap;
+    GcodeTotals totals;
+
+    int cost() const
+    {
+        const qint64 bytes = layers.count() * qint64(sizeof(GcodeLayer)) + points.count() * qint64(sizeof(QVector3D))
+                + indices.count() * qint64(sizeof(quint32)) + segments.count() * qint64(sizeof(GcodeSegment))
+                + travels.count() * qint64(sizeof(QVector3D)) + lineMap.count()
+                + lineMap.checkpoints().count() * qint64(sizeof(GcodeLineCheckpoint));
+        return int(qMin<qint64>(bytes, INT_MAX));
+    }
+};
+
+struct GcodeMemoryCache
+{
+    QMutex mutex;
+    QCache<QString, GcodeCacheEntry> entries { MaxCachedBytes };
+};
+
+Q_GLOBAL_STATIC(GcodeMemoryCache, memoryCache)
+
+bool GcodeCache::find(const QString &fileName, const QString &cacheFileName, GcodeParser *parser)
+{
+    const QFileInfo info(fileName);
+    const QString key = info.canonicalFilePath();
+    if (key.isEmpty())
+        return false;
+
+    const qint64 size = info.size();
+    const qint64 modified = info.lastModified().toMSecsSinceEpoch();
+    const quint32 flags = toFlags(*parser);
+
+    QMutexLocker locker(&memoryCache()->mutex);
+    GcodeCacheEntry *entry = memoryCache()->entries.object(key);
+    if (entry && entry->size == size && entry->modified == modified && (entry->flags & flags) == flags) {
+        parser->restore(entry->layers, entry->points, entry->indices, entry->segments, entry->travels,
+                        entry->lineMap, entry->totals);
+        setFlags(parser, entry->flags);
+        return true;
+    }
+    locker.unlock();
+
+    if (cacheFileName.isEmpty() || !read(cacheFileName, fileName, parser))
+        return false;
+
+    insert(fileName, QString(), *parser);
+    return true;
+}
+
+void GcodeCache::insert(const QString &fileName, const QString &cacheFileName, const GcodeParser &parser)
+{
+    const QFileInfo info(fileName);
+    const QString key = info.canonicalFilePath();
+    if (key.isEmpty())
+        return;
+
+    GcodeCacheEntry *entry = new GcodeCacheEntry{info.size(), info.lastModified().toMSecsSinceEpoch(),
+                                                 parser.layers(), parser.points(), parser.indices(),
+                                                 parser.segments(), toFlags(parser), parser.travels(),
+                                                 parser.lineMap(), parser.totals()};
+    // a file larger than the cache is not kept in memory (QCache deletes it
+    // right away), and only its cache file is written, if any
+    QMutexLocker locker(&memoryCache()->mutex);
+    memoryCache()->entries.remove(key);
+    memoryCache()->entries.insert(key, entry, entry->cost());
+    locker.unlock();
+
+    if (!cacheFileName.isEmpty())
+        write(cacheFileName, fileName, parser);
+}
+
+QString GcodeCache::cacheFileName(const QString &fileName, const QString &cacheDir)
+{
+    if (cacheDir.isEmpty())
+        return fileName + QLatin1String(".gcache");
+
+    const QByteArray path = QFileInfo(fileName).canonicalFilePath().toUtf8();
+    const QByteArray key = QCryptographicHash::hash(path, QCryptographicHash::Sha1).toHex();
+    return QDir(cacheDir).filePath(QString::fromLatin1(key) + QLatin1String(".gcache"));
+}
+
+// hashing the first and last blocks catches most edits that keep the size
+// and the modification time, without reading the whole file
+GcodeCache::Source GcodeCache::source(const QString &fileName)
+{
+    Source source;
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly))
+        return source;
+
+    source.size = file.size();
+    source.modified = QFileInfo(file).lastModified().toMSecsSinceEpoch();
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(file.read(HashBlockSize));
+    if (source.size > HashBlockSize && file.seek(qMax<qint64>(HashBlockSize, source.size - HashBlockSize)))
+        hash.addData(file.read(HashBlockSize));
+    source.hash = hash.result();
+    return source;
+}
+
+bool GcodeCache::read(const QString &cacheFileName, const QString &fileName, GcodeParser *parser)
+{
+    QFile file(cacheFileName);
+    if (!file.open(QFile::ReadOnly) || file.size() < qint64(sizeof(GcodeCacheHeader)))
+        return false;
+
+    const qint64 fileSize = file.size();
+    uchar *data = file.map(0, fileSize);
+    if (!data)
+        return false;
+
+    GcodeCacheHeader header;
+    memcpy(&header, data, sizeof(header));
+
+    const Source source = GcodeCache::source(fileName);
+    bool valid = header.magic == CacheMagic && header.version == CacheVersion
+            && header.size == source.size && header.modified == source.modified
+            && source.hash == QByteArray::fromRawData(header.hash, sizeof(header.hash))
+            && (header.flags & toFlags(*parser)) == toFlags(*parser)
+            && !memcmp(header.elementSizes, ElementSizes, sizeof(ElementSizes));
+    for (int i = 0; valid && i < SectionCount; ++i) {
+        valid = header.counts[i] >= 0 && header.offsets[i] >= qint64(sizeof(header))
+                && header.offsets[i] + qint64(header.counts[i]) * ElementSizes[i] <= fileSize;
+    }
+    valid = valid && header.counts[Indices] == 2 * header.counts[Segments] && header.counts[Travels] % 2 == 0
+            && (header.counts[LineDeltas] == header.counts[Segments] || !(header.flags & LineMapFlag));
+
+    if (valid) {
+        const QVector<GcodeLayer> layers = toVector<GcodeLayer>(data, header, Layers);
+        const QVector<quint32> indices = toVector<quint32>(data, header, Indices);
+        const quint32 pointCount = quint32(header.counts[Points]);
+        const GcodeLineMap lineMap(toVector<GcodeLineCheckpoint>(data, header, LineCheckpoints),
+                                   toVector<quint8>(data, header, LineDeltas));
+        valid = isValid(layers, header.counts[Indices], header.counts[Travels])
+                && std::all_of(indices.cbegin(), indices.cend(), [=](quint32 index) { return index < pointCount; })
+                && lineMap.isValid();
+
+        if (valid) {
+            GcodeTotals totals;
+            totals.printTime = header.printTime;
+            totals.travelDistance = header.travelDistance;
+            totals.extrusionDistance = header.extrusionDistance;
+            totals.extrusion = toVector<double>(data, header, Extrusion);
+
+            parser->restore(layers, toVector<QVector3D>(data, header, Points),
+                            indices, toVector<GcodeSegment>(data, header, Segments),
+                            toVector<QVector3D>(data, header, Travels),
+                            lineMap, totals);
+            setFlags(parser, header.flags);
+        }
+    }
+
+    file.unmap(data);
+    return valid;
+}
+
+bool GcodeCache::write(const QString &cacheFileName, const QString &fileName, const GcodeParser &parser)
+{
+    const Source source = GcodeCache::source(fileName);
+    if (source.size < 0 || source.hash.size() != sizeof(GcodeCacheHeader::hash))
+        return false;
+
+    const GcodeTotals &totals = parser.totals();
+    const void *arrays[SectionCount] = {
+        parser.layers().constData(), parser.points().constData(), parser.indices().constData(),
+        parser.segments().constData(), parser.travels().constData(),
+        parser.lineMap().checkpoints().constData(), parser.lineMap().deltas().constData(),
+        totals.extrusion.constData()
+    };
+
+    GcodeCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = CacheMagic;
+    header.version = CacheVersion;
+    header.size = source.size;
+    header.modified = source.modified;
+    memcpy(header.hash, source.hash.constData(), sizeof(header.hash));
+    header.flags = toFlags(parser);
+    memcpy(header.elementSizes, ElementSizes, sizeof(ElementSizes));
+    header.counts[Layers] = parser.layers().count();
+    header.counts[Points] = parser.points().count();
+    header.counts[Indices] = parser.indices().count();
+    header.counts[Segments] = parser.segments().count();
+    header.counts[Travels] = parser.travels().count();
+    header.counts[LineCheckpoints] = parser.lineMap().checkpoints().count();
+    header.counts[LineDeltas] = parser.lineMap().count();
+    header.counts[Extrusion] = totals.extrusion.count();
+    header.printTime = totals.printTime;
+    header.travelDistance = totals.travelDistance;
+    header.extrusionDistance = totals.extrusionDistance;
+
+    qint64 offset = aligned(sizeof(header));
+    for (int i = 0; i < SectionCount; ++i) {
+        header.offsets[i] = offset;
+        offset = aligned(offset + qint64(header.counts[i]) * ElementSizes[i]);
+    }
+
+    QDir().mkpath(QFileInfo(cacheFileName).absolutePath());
+    QSaveFile file(cacheFileName);
+    if (!file.open(QFile::WriteOnly))
+        return false;
+
+    if (file.write(reinterpret_cast<const char *>(&header), sizeof(header)) != qint64(sizeof(header)))
+        return false;
+
+    qint64 pos = sizeof(header);
+    for (int i = 0; i < SectionCount; ++i) {
+        const QByteArray padding(int(header.offsets[i] - pos), '\0');
+        const qint64 size = qint64(header.counts[i]) * ElementSizes[i];
+        if (file.write(padding) != padding.size() || file.write(static_cast<const char *>(arrays[i]), size) != size)
+            return false;
+        pos = header.offsets[i] + size;
+    }
+
+    return file.commit();
+}
@@ -0,0 +1,67 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#ifndef GCODECACHE_H
+#define GCODECACHE_H
+
+#include <QtCore/qbytearray.h>
+#include <QtCore/qstring.h>
+
+#include "gcodeparser.h"
+
+/*
+ * Stores the output of parsing a whole G-code file, so that the file can be
+ * re-opened, e.g. for each of its tools, without parsing it again.
+ *
+ * The output is cached in memory for the lifetime of the process, up to a
+ * fixed limit that larger files are left out of, and can be optionally
+ * persisted in a binary cache file. The cache file is a fixed header and the
+ * raw arrays of the parser, each aligned to 16 bytes, so that it can be
+ * read with a single memory map. It is keyed by the size and modification
+ * time of the G-code file, and a hash of its first and last blocks, and is
+ * stored next to the G-code file or in a cache directory.
+ */
+class GcodeCache
+{
+public:
+    static QString cacheFileName(const QString &fileName, const QString &cacheDir);
+
+    // the parser selects the optional outputs that the cache must contain
+    static bool find(const QString &fileName, const QString &cacheFileName, GcodeParser *parser);
+    static void insert(const QString &fileName, const QString &cacheFileName, const GcodeParser &parser);
+
+private:
+    friend class tst_GcodeCache;
+
+    struct Source
+    {
+        qint64 size = -1;
+        qint64 modified = 0;
+        QByteArray hash;
+    };
+
+    static Source source(const QString &fileName);
+    static bool read(const QString &cacheFileName, const QString &fileName, GcodeParser *parser);
+    static bool write(const QString &cacheFileName, const QString &fileName, const GcodeParser &parser);
+};
+
+#endif // GCODECACHE_H
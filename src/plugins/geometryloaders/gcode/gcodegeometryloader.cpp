@@ -20,76 +20,803 @@
 ****************************************************************************/
 
 #include "gcodegeometryloader.h"
+#include "gcodecache.h"
+#include "gcodegzipdevice.h"
+#include "gcodeindex.h"
+#include "gcodeprogress.h"
+#include "gcodesimplifier.h"
+#include "gcodespatialindex.h"
+#include "gcodestatistics.h"
+#include "gcodethumbnailer.h"
+#include "gcodetravels.h"
+#include "vertexquantizer.h"
+
+#include <QtConcurrent/qtconcurrentrun.h>
+#include <QtCore/qelapsedtimer.h>
+#include <QtCore/qfile.h>
+#include <QtCore/qstringlist.h>
+#include <QtCore/qthread.h>
+#include <QtCore/qvariant.h>
+#include <QtGui/qmatrix4x4.h>
 
 #include <Qt3DRender/qattribute.h>
 #include <Qt3DRender/qbuffer.h>
 #include <Qt3DRender/qgeometry.h>
 
-Qt3DRender::QGeometry *GcodeGeometryLoader::geometry() const
+#include <algorithm>
+#include <cstring>
+
+static const quint32 RestartIndex = 0xffffffff;
+
+// progressive loading parses a block at a time, a block per thread in the
+// background, and publishes the layers completed since the last time at
+// most once per interval
+static const int ProgressiveBlockSize = 1024 * 1024;
+static const int ProgressiveInterval = 250; // ms
+static const double ProgressiveReserve = 1024.0 * 1024 * 1024; // bytes per buffer, at most
+
+static const int DefaultThumbnailSize = 64; // px
+
+template <typename T>
+static QByteArray toByteArray(const QVector<T> &data)
 {
-    if (m_points.empty())
-        return nullptr;
+    return QByteArray(reinterpret_cast<const char *>(data.constData()), data.count() * sizeof(T));
+}
 
-    const int size = m_points.count() * sizeof(QVector3D);
-    const char *data = reinterpret_cast<const char *>(m_points.data());
+// one past the first newline after a block, or end
+static const char *blockEnd(const char *begin, const char *end, qint64 blockSize)
+{
+    if (end - begin <= blockSize)
+        return end;
+    const char *it = begin + blockSize;
+    const char *eol = static_cast<const char *>(memchr(it - 1, '\n', end - it + 1));
+    return eol ? eol + 1 : end;
+}
 
-    Qt3DRender::QGeometry *geometry = new Qt3DRender::QGeometry;
-    Qt3DRender::QBuffer *buffer = new Qt3DRender::QBuffer(geometry);
-    buffer->setData(QByteArray(data, size));
+// joins segments that continue from the previous one, and stores where in
+// the strips each segment starts, the strips continue after the strips of
+// the vertices before the offset
+static QVector<quint32> toLineStrips(const QVector<quint32> &indices, quint32 offset, bool restart,
+                                     QVector<int> *starts)
+{
+    QVector<quint32> strips;
+    strips.reserve(indices.count() + 1);
+    starts->resize(indices.count() / 2);
+    for (int i = 0; i < indices.count(); i += 2) {
+        if (i == 0 || indices.at(i) != indices.at(i - 1)) {
+            if (i > 0 || restart)
+                strips += RestartIndex;
+            strips += offset + indices.at(i);
+        }
+        (*starts)[i / 2] = strips.count() - 1;
+        strips += offset + indices.at(i + 1);
+    }
+    return strips;
+}
+
+// the first vertex (or index) and the vertex (or index) count of each layer,
+// after the vertices (or indices) before the offset
+static QVariantList toLayerRanges(const QVector<GcodeLayer> &layers, int count, const QVector<int> &starts,
+                                  int offset)
+{
+    QVariantList ranges;
+    for (int i = 0; i < layers.count(); ++i) {
+        int first = layers.at(i).index;
+        int last = i + 1 < layers.count() ? layers.at(i + 1).index : count;
+        if (!starts.isEmpty() && first < last) {
+            last = starts.at(last / 2 - 1) + 2;
+            first = starts.at(first / 2);
+        }
+        QVariantMap range;
+        range.insert(QStringLiteral("z"), layers.at(i).z);
+        range.insert(QStringLiteral("first"), offset + first);
+        range.insert(QStringLiteral("count"), last - first);
+        ranges += range;
+    }
+    return ranges;
+}
+
+// the segment of each vertex: the segment that ends at the vertex, or the
+// segment that starts a path, so that the attributes of a segment are those
+// of its last (provoking) vertex when they are not interpolated
+static QVector<int> toVertexSegments(const QVector<quint32> &indices, int count, bool expanded)
+{
+    QVector<int> segments(count);
+    for (int i = 0; i < indices.count(); i += 2) {
+        if (expanded) {
+            segments[i] = segments[i + 1] = i / 2;
+        } else {
+            if (i == 0 || indices.at(i) != indices.at(i - 1))
+                segments[indices.at(i)] = i / 2;
+            segments[indices.at(i + 1)] = i / 2;
+        }
+    }
+    return segments;
+}
+
+// keeps the segments of a tool and the points they use, and moves the
+// layers to the remaining segments, keeping their numbering
+static void selectTool(int tool, QVector<GcodeLayer> &layers, QVector<QVector3D> &points,
+                       QVector<quint32> &indices, QVector<GcodeSegment> &segments)
+{
+    QVector<quint32> map(points.count(), RestartIndex);
+    QVector<QVector3D> toolPoints;
+    QVector<quint32> toolIndices;
+    QVector<GcodeSegment> toolSegments;
+
+    int layer = 0;
+    for (int i = 0; i < segments.count(); ++i) {
+        for (; layer < layers.count() && layers.at(layer).index <= 2 * i; ++layer)
+            layers[layer].index = toolIndices.count();
+        if (segments.at(i).tool != tool)
+            continue;
+
+        for (int j = 2 * i; j < 2 * i + 2; ++j) {
+            quint32 &index = map[indices.at(j)];
+            if (index == RestartIndex) {
+                index = toolPoints.count();
+                toolPoints += points.at(indices.at(j));
+            }
+            toolIndices += index;
+        }
+        toolSegments += segments.at(i);
+    }
+    for (; layer < layers.count(); ++layer)
+        layers[layer].index = toolIndices.count();
+
+    points = toolPoints;
+    indices = toolIndices;
+    segments = toolSegments;
+}
+
+// the estimated time at the start of a segment: the end of the previous
+// segment of a path, or the nominal duration of the segment before its end,
+// and not before the end of the previous segment, or the given time
+static float startTime(const QVector<QVector3D> &points, const QVector<quint32> &indices,
+                       const QVector<GcodeSegment> &segments, int index, float before)
+{
+    const GcodeSegment &segment = segments.at(index);
+    const float previous = index > 0 ? segments.at(index - 1).time : before;
+    if (index > 0 && indices.at(2 * index) == indices.at(2 * index - 1))
+        return previous;
 
+    const float length = points.at(indices.at(2 * index)).distanceToPoint(points.at(indices.at(2 * index + 1)));
+    const float duration = segment.feedrate > 0 ? length * 60 / segment.feedrate : 0;
+    return qMax(previous, segment.time - duration);
+}
+
+static void addAttribute(Qt3DRender::QGeometry *geometry, Qt3DRender::QBuffer *buffer, const QString &name,
+                         Qt3DRender::QAttribute::VertexBaseType type, int size, int offset, int stride)
+{
     Qt3DRender::QAttribute *attribute = new Qt3DRender::QAttribute(geometry);
-    attribute->setName(Qt3DRender::QAttribute::defaultPositionAttributeName());
-    attribute->setVertexBaseType(Qt3DRender::QAttribute::Float);
-    attribute->setVertexSize(3);
-    attribute->setCount(m_points.count());
-    attribute->setByteStride(sizeof(QVector3D));
+    attribute->setName(name);
+    attribute->setVertexBaseType(type);
+    attribute->setVertexSize(size);
+    attribute->setByteOffset(offset);
+    attribute->setByteStride(stride);
     attribute->setBuffer(buffer);
-
     geometry->addAttribute(attribute);
-    return geometry;
 }
 
-static inline qreal readFloat(const QByteArray &command)
+static int positionSize(const GcodeGeometryLoader::Format &format)
 {
-    return command.mid(1).toFloat();
+    return format.compact ? 4 * sizeof(quint16) : sizeof(QVector3D);
 }
 
-static bool readLine(const QByteArray &line, QVector3D &vec)
+static int vertexStride(const GcodeGeometryLoader::Format &format)
 {
-    if (line.isEmpty() || !line.startsWith("G1 "))
-        return false;
+    return positionSize(format) + (format.attributes ? 2 * sizeof(float) + 2 * sizeof(quint32) : 0)
+            + (format.time ? sizeof(float) : 0);
+}
 
-    float e = 0;
-    const QByteArrayList commands = line.split(' ');
-    for (const QByteArray &command : commands) {
-        if (command.isEmpty())
-            continue;
-        switch (command.front()) {
-        case 'X':
-            vec.setX(readFloat(command));
-            break;
-        case 'Y':
-            vec.setY(readFloat(command));
-            break;
-        case 'Z':
-            vec.setZ(readFloat(command));
-            break;
-        case 'E':
-            e = readFloat(command);
-            break;
-        default:
-            break;
+// a range of layers of a parsed toolpath, with the points, indices and
+// segments they use, of a tool and simplified if requested
+struct GcodeToolpath
+{
+    int firstLayer = 0;
+    QVector<GcodeLayer> layers;
+    QVector<QVector3D> points;
+    QVector<quint32> indices;
+    QVector<GcodeSegment> segments;
+    float time = 0; // at the end of the segment before the range
+};
+
+// where the paths of a layer start in the indices (or the travel vertices),
+// the paths before the first layer (if any) belong to it
+static int layerStart(const QVector<GcodeLayer> &layers, int layer, int count, bool travels)
+{
+    if (layer == 0)
+        return 0;
+    if (layer >= layers.count())
+        return count;
+    return travels ? layers.at(layer).travel : layers.at(layer).index;
+}
+
+// a whole parsed file is cut to the layers of the format, which keep their
+// numbering, returns the first layer of a range with paths, the layers
+// before it are left empty
+static int cutLayers(const GcodeGeometryLoader::Format &format, const QVector<GcodeLayer> &layers,
+                     int firstLayer, int *lastLayer)
+{
+    if (format.lastLayer < layers.count())
+        *lastLayer = qMax(firstLayer, qMin(*lastLayer, format.lastLayer + 1));
+    return qBound(firstLayer, format.firstLayer, *lastLayer);
+}
+
+static GcodeToolpath toToolpath(const GcodeGeometryLoader::Format &format, const GcodeParser &parser,
+                                int firstLayer, int lastLayer)
+{
+    const QVector<GcodeLayer> &layers = parser.layers();
+    const int firstPath = cutLayers(format, layers, firstLayer, &lastLayer);
+
+    GcodeToolpath toolpath;
+    toolpath.firstLayer = firstLayer;
+    toolpath.layers = layers.mid(firstLayer, lastLayer - firstLayer);
+
+    // the indices are sorted, so the points of a range of indices are the
+    // range from the first index to the last one
+    const QVector<quint32> &indices = parser.indices();
+    const QVector<GcodeSegment> &segments = parser.segments();
+    const int first = layerStart(layers, firstPath, indices.count(), false);
+    const int last = layerStart(layers, lastLayer, indices.count(), false);
+    const int firstPoint = first < last ? indices.at(first) : 0;
+    const int lastPoint = first < last ? indices.at(last - 1) + 1 : 0;
+    toolpath.points = parser.points().mid(firstPoint, lastPoint - firstPoint);
+    toolpath.indices = indices.mid(first, last - first);
+    toolpath.segments = segments.mid(first / 2, (last - first) / 2);
+    if (first > 0) {
+        for (GcodeLayer &layer : toolpath.layers)
+            layer.index = qMax(0, layer.index - first);
+    }
+    if (firstPoint > 0) {
+        for (quint32 &index : toolpath.indices)
+            index -= firstPoint;
+    }
+
+    // the time starts at the first segment of the layers of the format
+    const int origin = layerStart(layers, format.firstLayer, indices.count(), false);
+    const float originTime = origin > 0 && origin < indices.count()
+            ? startTime(parser.points(), indices, segments, origin / 2, 0) : 0;
+    toolpath.time = (first > 0 ? segments.at(first / 2 - 1).time : 0) - originTime;
+    if (originTime > 0) {
+        for (GcodeSegment &segment : toolpath.segments)
+            segment.time -= originTime;
+    }
+
+    if (format.tool >= 0)
+        selectTool(format.tool, toolpath.layers, toolpath.points, toolpath.indices, toolpath.segments);
+    if (format.tolerance >= 0)
+        GcodeSimplifier::simplify(format.tolerance, toolpath.layers, toolpath.points, toolpath.indices,
+                                  toolpath.segments);
+    return toolpath;
+}
+
+// the contents of the buffers of a geometry, or of the layers appended to
+// them after the given vertices and indices, and its statistics, which can
+// be built in any thread
+struct GcodeBuffers
+{
+    QByteArray vertices;
+    int vertexOffset = 0;
+    int vertexCount = 0;
+    int vertexReserve = 0; // bytes expected for the whole geometry
+    QByteArray indices;
+    int indexOffset = 0;
+    int indexCount = 0;
+    int indexReserve = 0;
+    int firstLayer = 0;
+    QVariantList layerRanges;
+    QVector<QVector3D> travels;
+    int travelOffset = 0;
+    QVariantList travelRanges;
+    QVariant positionTransform;
+    QImage thumbnail;
+    QVariantList layerThumbnails;
+    GcodeSpatialGrid spatialGrid;
+
+    GcodeTotals totals;
+    QVector<float> layerHeights;
+    QVector3D minimum;
+    QVector3D maximum;
+};
+
+// the bounds are extended from the given point on, if any
+static void toStatistics(const GcodeParser &parser, int firstPoint, GcodeBuffers *buffers)
+{
+    buffers->totals = parser.totals();
+
+    const QVector<GcodeLayer> &layers = parser.layers();
+    buffers->layerHeights.reserve(layers.count());
+    for (int i = 0; i < layers.count(); ++i)
+        buffers->layerHeights += layers.at(i).z - (i > 0 ? layers.at(i - 1).z : 0);
+
+    const QVector<QVector3D> &points = parser.points();
+    if (firstPoint == 0 && !points.isEmpty())
+        buffers->minimum = buffers->maximum = points.first();
+    for (int i = firstPoint; i < points.count(); ++i) {
+        for (int axis = 0; axis < 3; ++axis) {
+            buffers->minimum[axis] = qMin(buffers->minimum[axis], points.at(i)[axis]);
+            buffers->maximum[axis] = qMax(buffers->maximum[axis], points.at(i)[axis]);
+        }
+    }
+}
+
+// the travel vertices of a range of layers, which follow the given ones
+static void toTravels(const GcodeGeometryLoader::Format &format, const GcodeParser &parser, int firstLayer,
+                      int lastLayer, int offset, GcodeBuffers *buffers)
+{
+    const QVector<GcodeLayer> &layers = parser.layers();
+    const int firstPath = cutLayers(format, layers, firstLayer, &lastLayer);
+
+    const QVector<QVector3D> &travels = parser.travels();
+    const int first = layerStart(layers, firstPath, travels.count(), true);
+    const int last = layerStart(layers, lastLayer, travels.count(), true);
+    QVector<GcodeLayer> travelLayers = layers.mid(firstLayer, lastLayer - firstLayer);
+    for (GcodeLayer &layer : travelLayers)
+        layer.index = qMax(0, layer.travel - first);
+
+    buffers->travels = travels.mid(first, last - first);
+    buffers->travelOffset = offset;
+    buffers->travelRanges = toLayerRanges(travelLayers, buffers->travels.count(), QVector<int>(), offset);
+}
+
+static void toThumbnails(const GcodeGeometryLoader::Format &format, const GcodeToolpath &toolpath,
+                         GcodeBuffers *buffers)
+{
+    const QSize size(format.thumbnailSize, format.thumbnailSize);
+    buffers->thumbnail = GcodeThumbnailer::render(size, toolpath.points, toolpath.indices);
+    const QVector<QImage> images = GcodeThumbnailer::renderLayers(size, toolpath.layers, toolpath.points,
+                                                                  toolpath.indices);
+    for (const QImage &image : images)
+        buffers->layerThumbnails += QVariant::fromValue(image);
+}
+
+// the vertices and indices of a toolpath, which follow the given vertices
+// and indices of the geometry
+static GcodeBuffers toBuffers(const GcodeGeometryLoader::Format &format, const GcodeToolpath &toolpath,
+                              const VertexQuantizer &quantizer, int vertexOffset, int indexOffset)
+{
+    const QVector<GcodeLayer> &layers = toolpath.layers;
+    const QVector<QVector3D> &points = toolpath.points;
+    const QVector<quint32> &indices = toolpath.indices;
+    const QVector<GcodeSegment> &segments = toolpath.segments;
+
+    const bool expanded = format.primitive == GcodeGeometryLoader::Lines;
+    const int count = expanded ? indices.count() : points.count();
+    const int stride = vertexStride(format);
+
+    QByteArray data(count * stride, Qt::Uninitialized);
+    for (int i = 0; i < count; ++i) {
+        const QVector3D &point = points.at(expanded ? indices.at(i) : i);
+        char *vertex = data.data() + i * stride;
+        if (format.compact)
+            quantizer.quantizePosition(point, reinterpret_cast<quint16 *>(vertex));
+        else
+            memcpy(vertex, &point, sizeof(QVector3D));
+    }
+
+    const QVector<int> vertexSegments = format.attributes || format.time
+            ? toVertexSegments(indices, count, expanded) : QVector<int>();
+
+    if (format.attributes) {
+        QVector<quint32> segmentLayers(segments.count());
+        for (int i = 0; i < layers.count(); ++i) {
+            const int last = i + 1 < layers.count() ? layers.at(i + 1).index : indices.count();
+            std::fill(segmentLayers.begin() + layers.at(i).index / 2, segmentLayers.begin() + last / 2,
+                      toolpath.firstLayer + i);
+        }
+
+        for (int i = 0; i < count; ++i) {
+            const int index = vertexSegments.at(i);
+            const GcodeSegment &segment = segments.at(index);
+            const QVector3D &from = points.at(indices.at(2 * index));
+            const float length = from.distanceToPoint(points.at(indices.at(2 * index + 1)));
+            const float values[] = { segment.feedrate, length > 0 ? segment.extrusion / length : 0 };
+            const quint32 ids[] = { quint32(segment.tool), segmentLayers.at(index) };
+            char *vertex = data.data() + i * stride + positionSize(format);
+            memcpy(vertex, values, sizeof(values));
+            memcpy(vertex + sizeof(values), ids, sizeof(ids));
+        }
+    }
+
+    // the time of a vertex is when the print reaches it, which is the end of
+    // its segment, or the start of a path
+    if (format.time) {
+        for (int i = 0; i < count; ++i) {
+            const int index = vertexSegments.at(i);
+            const bool start = expanded ? i % 2 == 0 : indices.at(2 * index) == quint32(i);
+            const float time = start ? startTime(points, indices, segments, index, toolpath.time)
+                                     : segments.at(index).time;
+            memcpy(data.data() + (i + 1) * stride - sizeof(float), &time, sizeof(float));
+        }
+    }
+
+    GcodeBuffers buffers;
+    buffers.vertices = data;
+    buffers.vertexOffset = vertexOffset;
+    buffers.vertexCount = count;
+
+    // maps the normalized compact positions back to model space
+    if (format.compact)
+        buffers.positionTransform = QVariant::fromValue(quantizer.transform());
+
+    QVector<int> starts;
+    if (!expanded) {
+        QVector<quint32> elements;
+        if (format.primitive == GcodeGeometryLoader::LineStrips) {
+            elements = toLineStrips(indices, vertexOffset, indexOffset > 0, &starts);
+        } else {
+            elements = indices;
+            if (vertexOffset > 0) {
+                for (quint32 &element : elements)
+                    element += vertexOffset;
+            }
+        }
+        buffers.indices = toByteArray(elements);
+        buffers.indexOffset = indexOffset;
+        buffers.indexCount = elements.count();
+    }
+
+    // the layers are drawn by adjusting firstVertex (or indexOffset) and
+    // vertexCount of the geometry renderer, without reloading the geometry
+    buffers.firstLayer = toolpath.firstLayer;
+    buffers.layerRanges = toLayerRanges(layers, indices.count(), starts, expanded ? vertexOffset : indexOffset);
+    return buffers;
+}
+
+static GcodeBuffers toBuffers(const GcodeGeometryLoader::Format &format, const GcodeParser &parser)
+{
+    const GcodeToolpath toolpath = toToolpath(format, parser, 0, parser.layers().count());
+    const VertexQuantizer quantizer = format.compact
+            ? VertexQuantizer::fromPoints(toolpath.points.cbegin(), toolpath.points.cend())
+            : VertexQuantizer(QVector3D(), QVector3D());
+    GcodeBuffers buffers = toBuffers(format, toolpath, quantizer, 0, 0);
+
+    if (format.travels)
+        toTravels(format, parser, 0, parser.layers().count(), 0, &buffers);
+
+    if (format.thumbnailSize > 0)
+        toThumbnails(format, toolpath, &buffers);
+
+    // segments are picked from the parsed toolpath, not the simplified one
+    if (format.spatialIndex)
+        buffers.spatialGrid = GcodeSpatialGrid(parser, format.tool);
+
+    if (format.statistics)
+        toStatistics(parser, 0, &buffers);
+    return buffers;
+}
+
+// what a progressive load has published to its geometry so far: the layers,
+// the vertices, indices and travel vertices, the bounds of the compact
+// positions, and the points in the bounds of the statistics
+struct GcodePublished
+{
+    int layerCount = 0;
+    int vertexCount = 0;
+    int indexCount = 0;
+    int travelCount = 0;
+    QVector3D minimum;
+    QVector3D maximum;
+    int pointCount = 0;
+    QVector3D pointMinimum;
+    QVector3D pointMaximum;
+};
+
+// all layers once parsing has finished, otherwise the last one can still
+// grow, and with the "time" option, the layers with a provisional time wait
+// for the planner to catch up
+static int completeLayerCount(const GcodeGeometryLoader::Format &format, const GcodeParser &parser,
+                              bool finished)
+{
+    const QVector<GcodeLayer> &layers = parser.layers();
+    if (finished)
+        return layers.count();
+
+    int count = qMax(0, layers.count() - 1);
+    if (format.time) {
+        while (count > 0 && layers.at(count).index > 2 * parser.timedSegmentCount())
+            --count;
+    }
+    return count;
+}
+
+// extends the bounds to the points, at least doubling the extent of each
+// axis that grows, so that the positions are quantized again only a few
+// times while a toolpath is loaded, returns whether the bounds have grown
+static bool growBounds(const QVector<QVector3D> &points, QVector3D *minimum, QVector3D *maximum)
+{
+    bool grown = false;
+    for (int axis = 0; axis < 3; ++axis) {
+        const float extent = (*maximum)[axis] - (*minimum)[axis];
+        float low = (*minimum)[axis];
+        float high = (*maximum)[axis];
+        for (const QVector3D &point : points) {
+            low = qMin(low, point[axis]);
+            high = qMax(high, point[axis]);
+        }
+        if (low < (*minimum)[axis]) {
+            (*minimum)[axis] = qMin(low, (*minimum)[axis] - extent);
+            grown = true;
+        }
+        if (high > (*maximum)[axis]) {
+            (*maximum)[axis] = qMax(high, (*maximum)[axis] + extent);
+            grown = true;
+        }
+    }
+    return grown;
+}
+
+// the buffers of the layers completed since the last time, or of all
+// completed layers when the compact positions need wider bounds
+static GcodeBuffers toNextBuffers(const GcodeGeometryLoader::Format &format, const GcodeParser &parser,
+                                  bool finished, GcodePublished *published)
+{
+    const int layerCount = completeLayerCount(format, parser, finished);
+    GcodeToolpath toolpath = toToolpath(format, parser, published->layerCount, layerCount);
+
+    if (format.compact && !toolpath.points.isEmpty()) {
+        if (published->vertexCount == 0) {
+            published->minimum = published->maximum = toolpath.points.first();
+            growBounds(toolpath.points, &published->minimum, &published->maximum);
+        } else if (growBounds(toolpath.points, &published->minimum, &published->maximum)) {
+            toolpath = toToolpath(format, parser, 0, layerCount);
+            published->vertexCount = 0;
+            published->indexCount = 0;
+            published->travelCount = 0;
+        }
+    }
+
+    const VertexQuantizer quantizer(published->minimum, published->maximum);
+    GcodeBuffers buffers = toBuffers(format, toolpath, quantizer, published->vertexCount, published->indexCount);
+    published->layerCount = layerCount;
+    published->vertexCount += buffers.vertexCount;
+    published->indexCount += buffers.indexCount;
+
+    if (format.travels) {
+        toTravels(format, parser, toolpath.firstLayer, layerCount, published->travelCount, &buffers);
+        published->travelCount += buffers.travels.count();
+    }
+
+    // the thumbnails and the spatial grid are built once, from all layers
+    if (format.thumbnailSize > 0 && finished)
+        toThumbnails(format, toToolpath(format, parser, 0, layerCount), &buffers);
+
+    if (format.spatialIndex && finished)
+        buffers.spatialGrid = GcodeSpatialGrid(parser, format.tool);
+
+    if (format.statistics) {
+        buffers.minimum = published->pointMinimum;
+        buffers.maximum = published->pointMaximum;
+        toStatistics(parser, published->pointCount, &buffers);
+        published->pointCount = parser.points().count();
+        published->pointMinimum = buffers.minimum;
+        published->pointMaximum = buffers.maximum;
+    }
+    return buffers;
+}
+
+// writes data after the first bytes of a buffer, in place while it fits in
+// the data of the buffer, otherwise into new data with room for the reserve
+static void appendData(Qt3DRender::QBuffer *buffer, int offset, const QByteArray &data, int reserve)
+{
+    if (offset + data.size() <= buffer->data().size()) {
+        if (!data.isEmpty())
+            buffer->updateData(offset, data);
+        return;
+    }
+
+    QByteArray bytes = buffer->data().left(offset) + data;
+    if (reserve > 0)
+        bytes.resize(qMax(reserve, bytes.size() + bytes.size() / 4));
+    buffer->setData(bytes);
+}
+
+// updates the buffers, the attribute counts and the properties of a
+// geometry, keeping the vertices, indices and layers before the offsets
+static void updateGeometry(Qt3DRender::QGeometry *geometry, const GcodeBuffers &buffers)
+{
+    const QVector<Qt3DRender::QAttribute *> attributes = geometry->attributes();
+    for (Qt3DRender::QAttribute *attribute : attributes) {
+        if (attribute->attributeType() == Qt3DRender::QAttribute::IndexAttribute) {
+            appendData(attribute->buffer(), buffers.indexOffset * sizeof(quint32), buffers.indices,
+                       buffers.indexReserve);
+            attribute->setCount(buffers.indexOffset + buffers.indexCount);
+        } else {
+            if (attribute->name() == Qt3DRender::QAttribute::defaultPositionAttributeName()) {
+                appendData(attribute->buffer(), buffers.vertexOffset * attribute->byteStride(), buffers.vertices,
+                           buffers.vertexReserve);
+            }
+            attribute->setCount(buffers.vertexOffset + buffers.vertexCount);
         }
     }
 
-    return e > 0;
+    const QVariantList layerRanges = geometry->property("layerRanges").toList().mid(0, buffers.firstLayer);
+    geometry->setProperty("layerRanges", layerRanges + buffers.layerRanges);
+    if (buffers.positionTransform.isValid())
+        geometry->setProperty("positionTransform", buffers.positionTransform);
+    if (!buffers.thumbnail.isNull()) {
+        geometry->setProperty("thumbnail", QVariant::fromValue(buffers.thumbnail));
+        geometry->setProperty("layerThumbnails", buffers.layerThumbnails);
+    }
+
+    QObject *object = geometry->property("statistics").value<QObject *>();
+    if (GcodeStatistics *statistics = qobject_cast<GcodeStatistics *>(object))
+        statistics->update(buffers.totals, buffers.layerHeights, buffers.minimum, buffers.maximum);
+
+    object = geometry->property("spatialIndex").value<QObject *>();
+    GcodeSpatialIndex *spatialIndex = qobject_cast<GcodeSpatialIndex *>(object);
+    if (spatialIndex && !buffers.spatialGrid.isEmpty())
+        spatialIndex->update(buffers.spatialGrid);
+
+    object = geometry->property("travels").value<QObject *>();
+    if (GcodeTravels *travels = qobject_cast<GcodeTravels *>(object))
+        travels->append(buffers.travelOffset, buffers.firstLayer, buffers.travels, buffers.travelRanges);
 }
 
-static QVector<QVector3D> filterPoints(const QVector<QVector3D> &points, float from, float to)
+// continues parsing a file in a background thread, a block per thread at a
+// time, and appends the layers completed since the last time to the
+// geometry in its own thread, into buffers sized for the whole file
+static void loadProgressively(Qt3DRender::QGeometry *geometry, GcodeProgress *progress,
+                              const GcodeGeometryLoader::Format &format, GcodeParser parser,
+                              GcodePublished published, const QString &fileName, qint64 offset,
+                              bool index, bool sidecar, bool cache, const QString &cacheFileName)
 {
-    QVector<QVector3D> filtered;
-    std::copy_if(points.cbegin(), points.cend(), std::back_inserter(filtered), [=](const QVector3D &vec){ return vec.z() >= from && vec.z() <= to; });
-    return filtered;
+    QFile file(fileName);
+    const qint64 fileSize = file.open(QIODevice::ReadOnly) ? file.size() : 0;
+    const qint64 size = fileSize - offset;
+    uchar *data = size > 0 ? file.map(offset, size) : nullptr;
+    const char *begin = reinterpret_cast<const char *>(data);
+    const char *end = data ? begin + size : begin;
+    parser.setOrigin(begin, offset);
+
+    const qint64 blockSize = qint64(ProgressiveBlockSize) * qMax(1, QThread::idealThreadCount());
+    const int stride = vertexStride(format);
+    QElapsedTimer timer;
+    timer.start();
+    for (const char *it = begin; !progress->isCanceled(); ) {
+        const char *next = blockEnd(it, end, blockSize);
+        parser.parseConcurrent(it, next);
+        it = next;
+
+        const bool finished = it == end || parser.atEnd();
+        if (finished || timer.elapsed() >= ProgressiveInterval) {
+            GcodeBuffers buffers = toNextBuffers(format, parser, finished, &published);
+            const qint64 bytesLoaded = offset + (it - begin);
+
+            // the rest of the file is expected to be like the part loaded
+            if (!finished) {
+                const double scale = 1.05 * fileSize / bytesLoaded;
+                buffers.vertexReserve = int(qMin(ProgressiveReserve, published.vertexCount * scale * stride));
+                buffers.indexReserve = int(qMin(ProgressiveReserve, published.indexCount * scale * sizeof(quint32)));
+            }
+
+            const int layerCount = published.layerCount;
+            QMetaObject::invokeMethod(progress, [=]() {
+                updateGeometry(geometry, buffers);
+                progress->setProgress(bytesLoaded, layerCount, finished);
+            }, Qt::QueuedConnection);
+            timer.restart();
+        }
+        if (finished)
+            break;
+    }
+
+    if (data)
+        file.unmap(data);
+
+    if (index && !progress->isCanceled() && !parser.atEnd())
+        GcodeIndex::insert(fileName, parser.layers(), sidecar);
+
+    if (cache && !progress->isCanceled())
+        GcodeCache::insert(fileName, cacheFileName, parser);
+}
+
+Qt3DRender::QGeometry *GcodeGeometryLoader::geometry() const
+{
+    if (isEmpty() && m_fileName.isEmpty())
+        return nullptr;
+
+    Qt3DRender::QGeometry *geometry = new Qt3DRender::QGeometry;
+    Qt3DRender::QBuffer *buffer = new Qt3DRender::QBuffer(geometry);
+
+    const int stride = vertexStride(m_format);
+    addAttribute(geometry, buffer, Qt3DRender::QAttribute::defaultPositionAttributeName(),
+                 m_format.compact ? Qt3DRender::QAttribute::UnsignedShort : Qt3DRender::QAttribute::Float,
+                 3, 0, stride);
+
+    if (m_format.attributes) {
+        int offset = positionSize(m_format);
+        addAttribute(geometry, buffer, feedrateAttributeName(), Qt3DRender::QAttribute::Float, 1, offset, stride);
+        offset += sizeof(float);
+        addAttribute(geometry, buffer, extrusionAttributeName(), Qt3DRender::QAttribute::Float, 1, offset, stride);
+        offset += sizeof(float);
+        addAttribute(geometry, buffer, toolAttributeName(), Qt3DRender::QAttribute::UnsignedInt, 1, offset, stride);
+        offset += sizeof(quint32);
+        addAttribute(geometry, buffer, layerAttributeName(), Qt3DRender::QAttribute::UnsignedInt, 1, offset, stride);
+    }
+
+    if (m_format.time) {
+        addAttribute(geometry, buffer, timeAttributeName(), Qt3DRender::QAttribute::Float, 1,
+                     stride - sizeof(float), stride);
+    }
+
+    if (m_format.primitive != Lines) {
+        Qt3DRender::QAttribute *indexAttribute = new Qt3DRender::QAttribute(geometry);
+        indexAttribute->setAttributeType(Qt3DRender::QAttribute::IndexAttribute);
+        indexAttribute->setVertexBaseType(Qt3DRender::QAttribute::UnsignedInt);
+        indexAttribute->setBuffer(new Qt3DRender::QBuffer(geometry));
+        geometry->addAttribute(indexAttribute);
+
+        if (m_format.primitive == LineStrips)
+            geometry->setProperty("restartIndexValue", RestartIndex);
+    }
+
+    if (m_format.statistics) {
+        GcodeStatistics *statistics = new GcodeStatistics(m_format.filamentDiameter, geometry);
+        geometry->setProperty("statistics", QVariant::fromValue<QObject *>(statistics));
+    }
+
+    if (m_format.spatialIndex) {
+        GcodeSpatialIndex *spatialIndex = new GcodeSpatialIndex(geometry);
+        geometry->setProperty("spatialIndex", QVariant::fromValue<QObject *>(spatialIndex));
+    }
+
+    if (m_format.travels) {
+        GcodeTravels *travels = new GcodeTravels(geometry);
+        geometry->setProperty("travels", QVariant::fromValue<QObject *>(travels));
+    }
+
+    if (m_fileName.isEmpty()) {
+        updateGeometry(geometry, toBuffers(m_format, m_parser));
+    } else {
+        GcodePublished published;
+        updateGeometry(geometry, toNextBuffers(m_format, m_parser, false, &published));
+
+        GcodeProgress *progress = new GcodeProgress(m_fileSize, geometry);
+        progress->setProgress(m_offset, published.layerCount, false);
+        geometry->setProperty("progress", QVariant::fromValue<QObject *>(progress));
+
+        const Format format = m_format;
+        const GcodeParser parser = m_parser;
+        const QString fileName = m_fileName;
+        const qint64 offset = m_offset;
+        const bool index = m_index;
+        const bool sidecar = m_sidecar;
+        const bool cache = m_cache;
+        const QString cacheFileName = m_cacheFileName;
+        progress->setFuture(QtConcurrent::run([=]() {
+            loadProgressively(geometry, progress, format, parser, published, fileName, offset, index,
+                              sidecar, cache, cacheFileName);
+        }));
+    }
+
+    return geometry;
+}
+
+QString GcodeGeometryLoader::feedrateAttributeName()
+{
+    return QStringLiteral("vertexFeedrate");
+}
+
+QString GcodeGeometryLoader::extrusionAttributeName()
+{
+    return QStringLiteral("vertexExtrusion");
+}
+
+QString GcodeGeometryLoader::toolAttributeName()
+{
+    return QStringLiteral("vertexTool");
+}
+
+QString GcodeGeometryLoader::layerAttributeName()
+{
+    return QStringLiteral("vertexLayer");
+}
+
+QString GcodeGeometryLoader::timeAttributeName()
+{
+    return QStringLiteral("vertexTime");
 }
 
 static QPair<int, int> parseRange(const QString &subMesh)
@@ -112,39 +839,187 @@ static QPair<int, int> parseRange(const QString &subMesh)
     return range;
 }
 
+struct GcodeOptions
+{
+    QPair<int, int> layers = qMakePair(0, INT_MAX);
+    bool index = false;
+    GcodeGeometryLoader::Format format;
+    bool progressive = false;
+    bool cache = false;
+    QString cacheDir;
+};
+
+// "layers=<from>-<to>;index;indexed|strips;compact;attributes;progressive;
+// simplify[=<tolerance>];statistics;diameter=<mm>;cache[=<dir>];tool=<n>;
+// travels;time;thumbnails[=<size>];spatialindex", or just "<from>-<to>"
+static GcodeOptions parseOptions(const QString &subMesh)
+{
+    GcodeOptions options;
+    const QStringList parts = subMesh.split(QLatin1Char(';'), QString::SkipEmptyParts);
+    for (const QString &part : parts) {
+        const int index = part.indexOf(QLatin1Char('='));
+        const QString key = part.left(index).trimmed();
+        const QString value = index == -1 ? QString() : part.mid(index + 1).trimmed();
+        if (key == QLatin1String("layers"))
+            options.layers = parseRange(value);
+        else if (key == QLatin1String("index"))
+            options.index = true;
+        else if (key == QLatin1String("indexed"))
+            options.format.primitive = GcodeGeometryLoader::IndexedLines;
+        else if (key == QLatin1String("strips"))
+            options.format.primitive = GcodeGeometryLoader::LineStrips;
+        else if (key == QLatin1String("compact"))
+            options.format.compact = true;
+        else if (key == QLatin1String("attributes"))
+            options.format.attributes = true;
+        else if (key == QLatin1String("progressive"))
+            options.progressive = true;
+        else if (key == QLatin1String("simplify"))
+            options.format.tolerance = qMax(0.0f, value.toFloat());
+        else if (key == QLatin1String("statistics"))
+            options.format.statistics = true;
+        else if (key == QLatin1String("diameter"))
+            options.format.filamentDiameter = value.toFloat();
+        else if (key == QLatin1String("tool"))
+            options.format.tool = value.toInt();
+        else if (key == QLatin1String("travels"))
+            options.format.travels = true;
+        else if (key == QLatin1String("time"))
+            options.format.time = true;
+        else if (key == QLatin1String("spatialindex"))
+            options.format.spatialIndex = true;
+        else if (key == QLatin1String("thumbnails"))
+            options.format.thumbnailSize = value.isEmpty() ? DefaultThumbnailSize : qMax(1, value.toInt());
+        else if (key == QLatin1String("cache")) {
+            options.cache = true;
+            options.cacheDir = value;
+        } else if (index == -1)
+            options.layers = parseRange(key);
+    }
+
+    // the segments of the spatial index are those of the parsed toolpath,
+    // which only match the vertices of unsimplified lines of all tools
+    const GcodeGeometryLoader::Format &format = options.format;
+    if (format.spatialIndex && (format.primitive == GcodeGeometryLoader::LineStrips || format.tolerance >= 0
+                                || format.tool >= 0)) {
+        qWarning("GcodeGeometryLoader: \"spatialindex\" is not supported with \"strips\", \"simplify\" or \"tool\"");
+        options.format.spatialIndex = false;
+    }
+    return options;
+}
+
 bool GcodeGeometryLoader::load(QIODevice *device, const QString &subMesh)
 {
     if (!device)
         return false;
 
-    m_layers.clear();
-    m_points.clear();
+    m_parser = GcodeParser();
+    m_fileName.clear();
 
-    float z = 0;
-    QVector3D prev;
-    QVector3D point;
-    while (!device->atEnd()) {
-        QByteArray line = device->readLine().trimmed();
-        if (readLine(line, point)) {
-            m_points += prev;
-            m_points += point;
-        }
-        if (!qFuzzyCompare(z, point.z())) {
-            m_layers += z;
-            z = point.z();
+    const GcodeOptions options = parseOptions(subMesh);
+    m_format = options.format;
+
+    QFileDevice *file = qobject_cast<QFileDevice *>(device);
+    const QString fileName = file ? file->fileName() : QString();
+    const qint64 start = file ? file->pos() : 0;
+
+    // a whole file is read from the cache if it is up to date, or cached with
+    // its totals once it has been parsed, so that each of its tools and layer
+    // ranges can be loaded from a single parse. The statistics and the
+    // spatial index of a layer range come from parsing only that range.
+    const bool whole = options.layers == qMakePair(0, INT_MAX);
+    const bool cached = (options.cache || options.format.tool >= 0) && !fileName.isEmpty() && start == 0
+            && (whole || (!options.format.statistics && !options.format.spatialIndex));
+    QPair<int, int> layers = options.layers;
+    if (cached && !whole) {
+        m_format.firstLayer = layers.first;
+        m_format.lastLayer = layers.second;
+        layers = qMakePair(0, INT_MAX);
+    }
+
+    GcodeParser parser;
+    parser.setLayerRange(layers.first, layers.second);
+    parser.setTotalsEnabled(options.format.statistics || options.format.time);
+    parser.setTravelsEnabled(options.format.travels);
+    parser.setLineMapEnabled(options.format.spatialIndex);
+
+    m_cache = false;
+    m_cacheFileName.clear();
+    if (cached) {
+        const QString cacheFileName = options.cache ? GcodeCache::cacheFileName(fileName, options.cacheDir)
+                                                    : QString();
+        if (GcodeCache::find(fileName, cacheFileName, &parser)) {
+            m_parser = std::move(parser);
+            return !isEmpty();
         }
-        prev = point;
+        parser.setTotalsEnabled(true);
+        m_cache = true;
+        m_cacheFileName = cacheFileName;
+    }
+
+    // compressed files are inflated block by block while parsing, which
+    // leaves them out of concurrent parsing and indexing
+    if (GcodeGzipDevice::isCompressed(device)) {
+        GcodeGzipDevice gzip(device);
+        parser.parse(&gzip);
+        if (m_cache)
+            GcodeCache::insert(fileName, m_cacheFileName, parser);
+        m_parser = std::move(parser);
+        return !isEmpty();
+    }
+
+    // continue from the first layer in range if the file has been indexed
+    qint64 offset = start;
+    if (!fileName.isEmpty() && start == 0 && layers.first > 0) {
+        const QVector<GcodeLayer> index = GcodeIndex::find(fileName, options.index);
+        if (layers.first < index.count())
+            offset = parser.seek(index, layers.first);
     }
 
-    if (!subMesh.isEmpty()) {
-        // ### TODO: filter the layers on the fly while reading above
-        QPair<int, int> range = parseRange(subMesh);
-        float from = m_layers.value(range.first);
-        float to = m_layers.value(range.second, std::numeric_limits<float>::max());
-        m_points = filterPoints(m_points, from, to);
+    const qint64 size = file ? file->size() - offset : 0;
+    uchar *data = size > 0 ? file->map(offset, size) : nullptr;
+    if (data) {
+        const char *begin = reinterpret_cast<const char *>(data);
+        const char *end = begin + size;
+        parser.setOrigin(begin, offset);
+        if (options.progressive && !fileName.isEmpty()) {
+            // only the first block is parsed here, and the rest continues in
+            // the background once the geometry has been created
+            const char *next = blockEnd(begin, end, ProgressiveBlockSize);
+            parser.parse(begin, next);
+            if (next != end && !parser.atEnd()) {
+                m_fileName = fileName;
+                m_fileSize = file->size();
+                m_offset = offset + (next - begin);
+                m_index = offset == 0;
+                m_sidecar = options.index;
+            }
+        } else {
+            parser.parseConcurrent(begin, end);
+        }
+        file->unmap(data);
+        file->seek(offset + size);
+    } else {
+        if (offset != start)
+            file->seek(offset);
+        parser.parse(device);
     }
 
-    return !m_points.isEmpty();
+    // index all layers of a file that was read from the beginning to the end
+    if (!fileName.isEmpty() && m_fileName.isEmpty() && offset == 0 && !parser.atEnd())
+        GcodeIndex::insert(fileName, parser.layers(), options.index);
+
+    // a progressive load writes the cache once it has finished
+    if (m_cache && m_fileName.isEmpty())
+        GcodeCache::insert(fileName, m_cacheFileName, parser);
+
+    m_parser = std::move(parser);
+    return !isEmpty() || !m_fileName.isEmpty();
+}
+
+bool GcodeGeometryLoader::isEmpty() const
+{
+    return m_parser.indices().isEmpty() && m_parser.travels().isEmpty();
 }
 
 QT_END_NAMESPACE
@@ -26,15 +26,121 @@
 #include <QtGui/qvector3d.h>
 #include <Qt3DRender/private/qgeometryloaderinterface_p.h>
 
+#include "gcodeparser.h"
+
 class GcodeGeometryLoader : public Qt3DRender::QGeometryLoaderInterface
 {
 public:
+    // Lines:        non-indexed pairs of vertices (default)
+    // IndexedLines: unique vertices and pairs of 32-bit indices
+    // LineStrips:   unique vertices and 32-bit line strip indices, separated
+    //               by the "restartIndexValue" property of the geometry
+    enum Primitive { Lines, IndexedLines, LineStrips };
+
+    // how the geometry is built
+    struct Format
+    {
+        Primitive primitive = Lines;
+        bool compact = false;
+        bool attributes = false;
+        float tolerance = -1; // simplification (mm), or negative to keep all
+        bool statistics = false;
+        float filamentDiameter = 1.75f; // mm
+        int tool = -1; // the only tool built, or negative for all
+        int firstLayer = 0; // the layers built of a whole parsed file
+        int lastLayer = INT_MAX;
+        bool travels = false;
+        bool time = false;
+        int thumbnailSize = 0; // px, or 0 for no thumbnails
+        bool spatialIndex = false;
+    };
+
+    // the vertices (or indices) are sorted by layer, and the "layerRanges"
+    // property of the geometry lists the z, first vertex (or index) and the
+    // vertex (or index) count of each layer
+
+    // compact vertices store positions as 16-bit normalized integers, which
+    // the "positionTransform" property of the geometry maps to model space
+
+    // with the "attributes" option, the feedrate (mm/min), the extrusion per
+    // mm, the tool and the layer index of each segment are interleaved with
+    // the positions, and belong to the last vertex of the segment
+
+    // with the "simplify" option, collinear segments are merged, and paths
+    // are decimated within the given tolerance (mm), e.g. "simplify=0.05"
+
+    // with the "statistics" option, the print time, distances, extruded length
+    // and volume per tool, bounds and layer heights are collected in the same
+    // pass, and the "statistics" property of the geometry is a GcodeStatistics
+    // object. The volume is based on the "diameter" option (mm).
+
+    // with the "progressive" option, only the first block of a file is parsed
+    // while loading. The rest is parsed in the background, and the layers
+    // completed since the last update are appended to the buffers of the
+    // geometry. Compact positions are quantized again within wider bounds
+    // when the toolpath outgrows them. The "progress" property of the
+    // geometry reports the bytes and layers loaded.
+
+    // with the "cache" option, the parsed toolpath and totals of a whole file
+    // are stored in a binary file next to it, or in the given directory, e.g.
+    // "cache=/tmp/gcode", and re-opening the file reads them from there
+
+    // with the "tool" option, only the segments of the given tool are built,
+    // e.g. "tool=2;layers=5-10", and the layers keep their numbering. A whole
+    // file is parsed once for all of its tools and layer ranges, since its
+    // parsed toolpath is kept in memory up to a fixed limit (see GcodeCache),
+    // unless a layer range has the "statistics" or "spatialindex" options.
+
+    // with the "travels" option, the moves without extrusion are collected
+    // in the same pass, and the "travels" property of the geometry is a
+    // GcodeTravels object, whose geometry of lines of positions only is built
+    // the first time it is read. With the "cache" or "tool" options, the
+    // travels are cached along with the rest of the file once they have been
+    // collected.
+
+    // with the "time" option, the estimated print time (s) when the print
+    // reaches each vertex is stored after the other attributes of the vertex,
+    // so that a material can show the progress of the print up to a time
+    // without rebuilding the geometry. The time starts at the first layer
+    // loaded.
+
+    // with the "thumbnails" option, the extrusion paths are drawn from above
+    // into square antialiased images of the given size (px), e.g.
+    // "thumbnails=128". The "thumbnail" property of the geometry is a QImage
+    // of all layers, and "layerThumbnails" is a list of a QImage per layer.
+    // A progressive load sets them once it has finished.
+
+    // with the "spatialindex" option, the "spatialIndex" property of the
+    // geometry is a GcodeSpatialIndex, which finds the segment nearest to a
+    // point, or the segments of a layer within a rectangle, and maps segments
+    // to the numbers of their lines (from 0) and back. The first vertex (or
+    // index) of segment n is 2 * n, so the option is ignored, with a warning,
+    // for line strips and for simplified or single tool geometry. A
+    // progressive load builds the index once it has finished.
+
     Qt3DRender::QGeometry *geometry() const override;
     bool load(QIODevice *device, const QString &subMesh = QString()) override;
 
+    static QString feedrateAttributeName();
+    static QString extrusionAttributeName();
+    static QString toolAttributeName();
+    static QString layerAttributeName();
+    static QString timeAttributeName();
+
 private:
-    QList<float> m_layers;
-    QVector<QVector3D> m_points;
+    bool isEmpty() const;
+
+    Format m_format;
+    GcodeParser m_parser;
+
+    // where a progressive load continues, and whether to index the file
+    QString m_fileName;
+    qint64 m_fileSize = 0;
+    qint64 m_offset = 0;
+    bool m_index = false;
+    bool m_sidecar = false;
+    bool m_cache = false;
+    QString m_cacheFileName;
 };
 
 #endif // GCODEGEOMETRYLOADER_H
@@ -24,6 +24,7 @@
 #include "gcodegeometryloader.h"
 
 static inline QString gcode() { return QStringLiteral("gcode"); }
+static inline QString gz() { return QStringLiteral("gz"); }
 
 class DefaultGeometryLoaderPlugin : public Qt3DRender::QGeometryLoaderFactory
 {
@@ -33,12 +34,12 @@ class DefaultGeometryLoaderPlugin : public Qt3DRender::QGeometryLoaderFactory
 public:
     QStringList keys() const override
     {
-        return QStringList() << gcode();
+        return QStringList() << gcode() << gz();
     }
 
     Qt3DRender::QGeometryLoaderInterface *create(const QString &ext) override
     {
-        if (ext.compare(gcode(), Qt::CaseInsensitive) == 0)
+        if (ext.compare(gcode(), Qt::CaseInsensitive) == 0 || ext.compare(gz(), Qt::CaseInsensitive) == 0)
             return new GcodeGeometryLoader;
         return nullptr;
     }
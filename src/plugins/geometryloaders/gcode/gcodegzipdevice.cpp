@@ -0,0 +1,109 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#include "gcodegzipdevice.h"
+
+#include <climits>
+#include <cstring>
+
+#include <zlib.h>
+
+static const int InputSize = 64 * 1024;
+
+GcodeGzipDevice::GcodeGzipDevice(QIODevice *source, QObject *parent)
+    : QIODevice(parent),
+      m_source(source),
+      m_input(InputSize, Qt::Uninitialized),
+      m_stream(new z_stream)
+{
+    memset(m_stream.data(), 0, sizeof(z_stream));
+
+    // 32 detects the gzip or zlib header automatically
+    if (inflateInit2(m_stream.data(), MAX_WBITS + 32) == Z_OK)
+        open(QIODevice::ReadOnly);
+    else
+        setErrorString(QString::fromLatin1(m_stream->msg));
+}
+
+GcodeGzipDevice::~GcodeGzipDevice()
+{
+    inflateEnd(m_stream.data());
+}
+
+bool GcodeGzipDevice::isCompressed(QIODevice *device)
+{
+    const QByteArray magic = device->peek(2);
+    return magic.size() == 2 && uchar(magic.at(0)) == 0x1f && uchar(magic.at(1)) == 0x8b;
+}
+
+bool GcodeGzipDevice::isSequential() const
+{
+    return true;
+}
+
+bool GcodeGzipDevice::atEnd() const
+{
+    return m_end && QIODevice::atEnd();
+}
+
+qint64 GcodeGzipDevice::readData(char *data, qint64 maxSize)
+{
+    m_stream->next_out = reinterpret_cast<Bytef *>(data);
+    m_stream->avail_out = static_cast<uInt>(qMin<qint64>(maxSize, INT_MAX));
+
+    while (m_stream->avail_out > 0 && !m_end) {
+        if (m_stream->avail_in == 0) {
+            const qint64 read = m_source->read(m_input.data(), m_input.size());
+            if (read < 0) {
+                setErrorString(m_source->errorString());
+                return -1;
+            }
+            if (read == 0) {
+                m_end = true; // truncated, keep what has been inflated
+                break;
+            }
+            m_stream->next_in = reinterpret_cast<Bytef *>(m_input.data());
+            m_stream->avail_in = static_cast<uInt>(read);
+        }
+
+        const int result = inflate(m_stream.data(), Z_NO_FLUSH);
+        if (result == Z_STREAM_END) {
+            // concatenated gzip members continue the same file
+            if (m_stream->avail_in > 0 || !m_source->atEnd())
+                inflateReset(m_stream.data());
+            else
+                m_end = true;
+        } else if (result != Z_OK && result != Z_BUF_ERROR) {
+            setErrorString(QString::fromLatin1(m_stream->msg ? m_stream->msg : "inflate failed"));
+            return -1;
+        }
+    }
+
+    return reinterpret_cast<char *>(m_stream->next_out) - data;
+}
+
+qint64 GcodeGzipDevice::writeData(const char *data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
@@ -0,0 +1,56 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#ifndef GCODEGZIPDEVICE_H
+#define GCODEGZIPDEVICE_H
+
+#include <QtCore/qbytearray.h>
+#include <QtCore/qiodevice.h>
+#include <QtCore/qscopedpointer.h>
+
+struct z_stream_s;
+
+// inflates a gzip (or zlib) compressed device while reading it, without
+// keeping more than a block of the compressed or decompressed data around
+class GcodeGzipDevice : public QIODevice
+{
+public:
+    explicit GcodeGzipDevice(QIODevice *source, QObject *parent = nullptr);
+    ~GcodeGzipDevice() override;
+
+    static bool isCompressed(QIODevice *device);
+
+    bool isSequential() const override;
+    bool atEnd() const override;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    QIODevice *m_source = nullptr;
+    QByteArray m_input;
+    QScopedPointer<z_stream_s> m_stream;
+    bool m_end = false;
+};
+
+#endif // GCODEGZIPDEVICE_H
@@ -0,0 +1,177 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#include "gcodeindex.h"
+
+#include <QtCore/qcache.h>
+#include <QtCore/qdatastream.h>
+#include <QtCore/qdatetime.h>
+#include <QtCore/qfile.h>
+#include <QtCore/qfileinfo.h>
+#include <QtCore/qmutex.h>
+#include <QtCore/qsavefile.h>
+
+static const quint32 IndexMagic = 0x47434958; // "GCIX"
+static const quint32 IndexVersion = 4;
+static const int MaxCachedLayers = 1024 * 1024;
+// the height, offset, line number and the state of a layer in the file
+static const qint64 LayerRecordSize = 4 + 8 + 4 + 6 * 4 + 2 * 1 + 4;
+
+struct GcodeIndexEntry
+{
+    qint64 size;
+    qint64 modified;
+    QVector<GcodeLayer> layers;
+};
+
+struct GcodeIndexCache
+{
+    QMutex mutex;
+    QCache<QString, GcodeIndexEntry> entries { MaxCachedLayers };
+};
+
+Q_GLOBAL_STATIC(GcodeIndexCache, cache)
+
+QVector<GcodeLayer> GcodeIndex::find(const QString &fileName, bool sidecar)
+{
+    const QFileInfo info(fileName);
+    const QString key = info.canonicalFilePath();
+    if (key.isEmpty())
+        return QVector<GcodeLayer>();
+
+    const qint64 size = info.size();
+    const qint64 modified = info.lastModified().toMSecsSinceEpoch();
+
+    QMutexLocker locker(&cache()->mutex);
+    GcodeIndexEntry *entry = cache()->entries.object(key);
+    if (entry && entry->size == size && entry->modified == modified)
+        return entry->layers;
+    locker.unlock();
+
+    if (!sidecar)
+        return QVector<GcodeLayer>();
+
+    const QVector<GcodeLayer> layers = read(sidecarFileName(key), size, modified);
+    if (!layers.isEmpty()) {
+        locker.relock();
+        cache()->entries.insert(key, new GcodeIndexEntry{size, modified, layers}, layers.count());
+    }
+    return layers;
+}
+
+void GcodeIndex::insert(const QString &fileName, const QVector<GcodeLayer> &layers, bool sidecar)
+{
+    const QFileInfo info(fileName);
+    const QString key = info.canonicalFilePath();
+    if (key.isEmpty() || layers.isEmpty())
+        return;
+
+    const qint64 size = info.size();
+    const qint64 modified = info.lastModified().toMSecsSinceEpoch();
+
+    QMutexLocker locker(&cache()->mutex);
+    cache()->entries.insert(key, new GcodeIndexEntry{size, modified, layers}, layers.count());
+    locker.unlock();
+
+    if (sidecar)
+        write(sidecarFileName(key), size, modified, layers);
+}
+
+QString GcodeIndex::sidecarFileName(const QString &fileName)
+{
+    return fileName + QLatin1String(".idx");
+}
+
+static QDataStream &operator>>(QDataStream &stream, GcodeState &state)
+{
+    float x = 0, y = 0, z = 0;
+    qint32 tool = 0;
+    stream >> x >> y >> z >> state.e >> state.feedrate >> state.acceleration
+           >> state.relative >> state.relativeExtrusion >> tool;
+    state.position = QVector3D(x, y, z);
+    state.tool = tool;
+    return stream;
+}
+
+static QDataStream &operator<<(QDataStream &stream, const GcodeState &state)
+{
+    stream << state.position.x() << state.position.y() << state.position.z() << state.e << state.feedrate
+           << state.acceleration << state.relative << state.relativeExtrusion << qint32(state.tool);
+    return stream;
+}
+
+QVector<GcodeLayer> GcodeIndex::read(const QString &fileName, qint64 size, qint64 modified)
+{
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly))
+        return QVector<GcodeLayer>();
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_12);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+    quint32 magic = 0, version = 0;
+    qint64 sourceSize = 0, sourceModified = 0;
+    qint32 count = 0;
+    stream >> magic >> version >> sourceSize >> sourceModified >> count;
+    if (magic != IndexMagic || version != IndexVersion || sourceSize != size || sourceModified != modified
+            || count < 0 || count > (file.size() - file.pos()) / LayerRecordSize) {
+        return QVector<GcodeLayer>();
+    }
+
+    // the layers are seeked to without checks, so they must start in order
+    // within the file, and each line takes at least a byte
+    QVector<GcodeLayer> layers;
+    layers.reserve(count);
+    GcodeLayer previous = {0, 0, 0, 0, 0, GcodeState()};
+    for (int i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        GcodeLayer layer = {0, 0, 0, 0, 0, GcodeState()};
+        stream >> layer.z >> layer.offset >> layer.line >> layer.state;
+        if (layer.offset < previous.offset || layer.offset > size || layer.line < previous.line
+                || layer.line > layer.offset) {
+            return QVector<GcodeLayer>();
+        }
+        layers += layer;
+        previous = layer;
+    }
+
+    if (stream.status() != QDataStream::Ok)
+        return QVector<GcodeLayer>();
+    return layers;
+}
+
+bool GcodeIndex::write(const QString &fileName, qint64 size, qint64 modified, const QVector<GcodeLayer> &layers)
+{
+    QSaveFile file(fileName);
+    if (!file.open(QFile::WriteOnly))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_12);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+    stream << IndexMagic << IndexVersion << size << modified << qint32(layers.count());
+    for (const GcodeLayer &layer : layers)
+        stream << layer.z << layer.offset << layer.line << layer.state;
+
+    return stream.status() == QDataStream::Ok && file.commit();
+}
@@ -0,0 +1,52 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#ifndef GCODEINDEX_H
+#define GCODEINDEX_H
+
+#include <QtCore/qstring.h>
+#include <QtCore/qvector.h>
+
+#include "gcodeparser.h"
+
+/*
+ * Remembers where each layer of a G-code file starts, and the state of the
+ * machine there, so that a range of layers can be loaded without re-reading
+ * the file from the beginning.
+ *
+ * Indices are cached in memory for the lifetime of the process, and can be
+ * optionally persisted in a sidecar file next to the G-code file. Both are
+ * keyed by the path, size and modification time of the file.
+ */
+class GcodeIndex
+{
+public:
+    static QVector<GcodeLayer> find(const QString &fileName, bool sidecar);
+    static void insert(const QString &fileName, const QVector<GcodeLayer> &layers, bool sidecar);
+
+private:
+    static QString sidecarFileName(const QString &fileName);
+    static QVector<GcodeLayer> read(const QString &fileName, qint64 size, qint64 modified);
+    static bool write(const QString &fileName, qint64 size, qint64 modified, const QVector<GcodeLayer> &layers);
+};
+
+#endif // GCODEINDEX_H
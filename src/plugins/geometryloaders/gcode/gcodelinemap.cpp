@@ -0,0 +1,126 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#include "gcodelinemap.h"
+
+#include <algorithm>
+#include <climits>
+
+GcodeLineMap::GcodeLineMap(const QVector<GcodeLineCheckpoint> &checkpoints, const QVector<quint8> &deltas)
+    : m_checkpoints(checkpoints),
+      m_deltas(deltas),
+      m_lastLine(isValid() ? lineOf(deltas.count() - 1) : -1)
+{
+}
+
+// whether restored arrays make a map, see GcodeCache
+bool GcodeLineMap::isValid() const
+{
+    if (m_deltas.isEmpty())
+        return m_checkpoints.isEmpty();
+    if (m_checkpoints.isEmpty() || m_checkpoints.first().segment != 0)
+        return false;
+
+    for (int i = 1; i < m_checkpoints.count(); ++i) {
+        const GcodeLineCheckpoint &previous = m_checkpoints.at(i - 1);
+        const GcodeLineCheckpoint &checkpoint = m_checkpoints.at(i);
+        if (checkpoint.segment <= previous.segment || checkpoint.segment - previous.segment > Interval
+                || checkpoint.line < previous.line)
+            return false;
+    }
+    return m_checkpoints.last().segment < m_deltas.count()
+            && m_deltas.count() - m_checkpoints.last().segment <= Interval;
+}
+
+// appends a segment of a line at or after the line of the last segment
+void GcodeLineMap::append(int line)
+{
+    const int segment = m_deltas.count();
+    const int delta = line - m_lastLine;
+    if (m_checkpoints.isEmpty() || segment - m_checkpoints.last().segment >= Interval
+            || delta < 0 || delta > UCHAR_MAX) {
+        m_checkpoints += GcodeLineCheckpoint{segment, line};
+        m_deltas += 0;
+    } else {
+        m_deltas += quint8(delta);
+    }
+    m_lastLine = line;
+}
+
+// appends the segments of a map of the lines that follow the given number
+// of lines, e.g. of a chunk
+void GcodeLineMap::append(const GcodeLineMap &other, int lineOffset)
+{
+    m_deltas.reserve(m_deltas.count() + other.count());
+    int line = 0;
+    for (int segment = 0, checkpoint = 0; segment < other.count(); ++segment) {
+        if (checkpoint < other.m_checkpoints.count() && other.m_checkpoints.at(checkpoint).segment == segment)
+            line = other.m_checkpoints.at(checkpoint++).line;
+        else
+            line += other.m_deltas.at(segment);
+        append(lineOffset + line);
+    }
+}
+
+void GcodeLineMap::clear()
+{
+    m_checkpoints.clear();
+    m_deltas.clear();
+    m_lastLine = -1;
+}
+
+// the line number of a segment, or -1
+int GcodeLineMap::lineOf(int segment) const
+{
+    if (segment < 0 || segment >= count())
+        return -1;
+
+    const auto it = std::upper_bound(m_checkpoints.cbegin(), m_checkpoints.cend(), segment,
+                                     [](int segment, const GcodeLineCheckpoint &checkpoint) {
+        return segment < checkpoint.segment;
+    }) - 1;
+    int line = it->line;
+    for (int i = it->segment + 1; i <= segment; ++i)
+        line += m_deltas.at(i);
+    return line;
+}
+
+// the first segment of the given line, or of the next line with segments, or
+// count() if there are none
+int GcodeLineMap::segmentAt(int line) const
+{
+    const auto next = std::lower_bound(m_checkpoints.cbegin(), m_checkpoints.cend(), line,
+                                       [](const GcodeLineCheckpoint &checkpoint, int line) {
+        return checkpoint.line < line;
+    });
+    if (next == m_checkpoints.cbegin())
+        return next == m_checkpoints.cend() ? count() : next->segment;
+
+    // the segment lies after the previous checkpoint, at the latest at the next
+    const auto previous = next - 1;
+    const int end = next == m_checkpoints.cend() ? count() : next->segment;
+    int segment = previous->segment;
+    int current = previous->line;
+    while (current < line && ++segment < end)
+        current += m_deltas.at(segment);
+    return current >= line ? segment : end;
+}
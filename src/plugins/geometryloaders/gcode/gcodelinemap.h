@@ -0,0 +1,75 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#ifndef GCODELINEMAP_H
+#define GCODELINEMAP_H
+
+#include <QtCore/qvector.h>
+
+// the absolute line number of a segment
+struct GcodeLineCheckpoint
+{
+    int segment;
+    int line;
+};
+Q_DECLARE_TYPEINFO(GcodeLineCheckpoint, Q_PRIMITIVE_TYPE);
+
+/*
+ * Maps segments to the numbers (from 0) of the lines they were parsed from,
+ * and back, in about a byte per segment.
+ *
+ * The line numbers of the segments never decrease. Each segment stores the
+ * number of lines since the previous segment in a byte, and the absolute line
+ * number is stored as a checkpoint at least every Interval segments, and for
+ * the segments that follow a gap of more lines than fit in a byte. Either
+ * lookup is a binary search of the checkpoints and a scan of the deltas
+ * after one of them.
+ */
+class GcodeLineMap
+{
+public:
+    static const int Interval = 64;
+
+    GcodeLineMap() = default;
+    GcodeLineMap(const QVector<GcodeLineCheckpoint> &checkpoints, const QVector<quint8> &deltas);
+
+    int count() const { return m_deltas.count(); }
+    bool isEmpty() const { return m_deltas.isEmpty(); }
+    bool isValid() const;
+
+    void append(int line);
+    void append(const GcodeLineMap &other, int lineOffset);
+    void clear();
+
+    int lineOf(int segment) const;
+    int segmentAt(int line) const;
+
+    const QVector<GcodeLineCheckpoint> &checkpoints() const { return m_checkpoints; }
+    const QVector<quint8> &deltas() const { return m_deltas; }
+
+private:
+    QVector<GcodeLineCheckpoint> m_checkpoints;
+    QVector<quint8> m_deltas; // 0 at the checkpoints
+    int m_lastLine = -1;
+};
+
+#endif // GCODELINEMAP_H
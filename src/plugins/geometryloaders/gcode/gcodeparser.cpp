@@ -0,0 +1,848 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#include "gcodeparser.h"
+
+#include <QtConcurrent/qtconcurrentmap.h>
+#include <QtCore/qiodevice.h>
+#include <QtCore/qnumeric.h>
+#include <QtCore/qthread.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static const int BlockSize = 64 * 1024;
+static const int MinChunkSize = 1024 * 1024;
+
+// the look-ahead of the planner and the junction deviation (mm) of Marlin
+static const int PlannerQueueSize = 16;
+static const float JunctionDeviation = 0.013f;
+
+static inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char *skipSpaces(const char *it, const char *end)
+{
+    while (it != end && isSpace(*it))
+        ++it;
+    return it;
+}
+
+static inline const char *skipWord(const char *it, const char *end)
+{
+    while (it != end && !isSpace(*it))
+        ++it;
+    return it;
+}
+
+// G-code numbers are plain decimals without exponents, so that words can be
+// packed without spaces (e.g. "G1X10Y5E1"). The scan stays scalar, since
+// typical words are too short for a vectorized scan to pay off (see the
+// readFloat benchmark of the parser autotest).
+float GcodeParser::readFloat(const char *&it, const char *end, bool *ok)
+{
+    static const double powersOf10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+                                         1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18 };
+
+    const char *p = it;
+    const bool negative = p != end && *p == '-';
+    if (p != end && (*p == '-' || *p == '+'))
+        ++p;
+
+    quint64 mantissa = 0;
+    int digits = 0;
+    int decimals = 0;
+    bool dot = false;
+    for (; p != end; ++p) {
+        const char c = *p;
+        if (c >= '0' && c <= '9') {
+            if (digits < 18) {
+                mantissa = mantissa * 10 + (c - '0');
+                ++digits;
+                decimals += dot;
+            } else {
+                decimals -= !dot; // drop insignificant digits
+            }
+        } else if (c == '.' && !dot) {
+            dot = true;
+        } else {
+            break;
+        }
+    }
+
+    *ok = digits > 0;
+    if (!*ok)
+        return 0;
+
+    it = p;
+    double value = mantissa;
+    if (decimals > 0)
+        value /= powersOf10[decimals];
+    else if (decimals < 0)
+        value *= std::pow(10.0, -decimals);
+    return static_cast<float>(negative ? -value : value);
+}
+
+// strips the comment and reads the command (first word) of a line
+static bool readCommand(const char *&it, const char *&end, char *letter, float *number)
+{
+    if (const char *comment = static_cast<const char *>(memchr(it, ';', end - it)))
+        end = comment;
+
+    bool ok = false;
+    it = skipSpaces(it, end);
+    if (it == end)
+        return false;
+    *letter = *it++;
+    *number = GcodeParser::readFloat(it, end, &ok);
+    return ok;
+}
+
+static inline bool sameLayer(float z1, float z2)
+{
+    // unknown (NaN) heights in chunks are the same entry height
+    return qFuzzyCompare(z1, z2) || (qIsNaN(z1) && qIsNaN(z2));
+}
+
+// M204 sets the printing (P) or both (S) accelerations
+static float readAcceleration(const char *it, const char *end, float acceleration)
+{
+    bool ok = false;
+    while ((it = skipSpaces(it, end)) != end) {
+        const char letter = *it++;
+        const float value = GcodeParser::readFloat(it, end, &ok);
+        if (!ok)
+            it = skipWord(it, end);
+        else if (letter == 'S' || letter == 'P')
+            acceleration = value;
+    }
+    return acceleration;
+}
+
+// the fastest speed at one end of a move that reaches a speed at the other end
+static inline float reachableSpeed(const GcodePlannedMove &move, float speed)
+{
+    if (move.acceleration <= 0)
+        return move.speed;
+    return std::sqrt(speed * speed + 2 * move.acceleration * move.length);
+}
+
+// the fastest speed through the corner between two moves that keeps within
+// the junction deviation, see Grbl and Marlin
+static float junctionSpeed(const GcodePlannedMove &from, const GcodePlannedMove &to)
+{
+    if (from.direction.isNull() || to.direction.isNull())
+        return 0;
+
+    // the cosine of the angle between the moves, -1 when going straight on
+    const float cosine = -QVector3D::dotProduct(from.direction, to.direction);
+    const float speed = qMin(from.speed, to.speed);
+    if (cosine > 0.999999f)
+        return 0;
+    if (cosine < -0.999999f || to.acceleration <= 0)
+        return speed;
+
+    const float halfSine = std::sqrt(0.5f * (1 - cosine));
+    return qMin(speed, std::sqrt(to.acceleration * JunctionDeviation * halfSine / (1 - halfSine)));
+}
+
+// a trapezoidal velocity profile between the entry and exit speeds
+static double moveTime(const GcodePlannedMove &move, float entry, float exit)
+{
+    const double speed = move.speed;
+    if (move.acceleration <= 0)
+        return move.length / speed;
+
+    const double acceleration = move.acceleration;
+    const double accelerating = (speed * speed - entry * entry) / (2 * acceleration);
+    const double decelerating = (speed * speed - exit * exit) / (2 * acceleration);
+    if (accelerating + decelerating <= move.length)
+        return (move.length - accelerating - decelerating) / speed + (2 * speed - entry - exit) / acceleration;
+
+    // the move is too short to reach its nominal speed
+    const double peak = std::sqrt(acceleration * move.length + (entry * entry + exit * exit) / 2.0);
+    return (2 * peak - entry - exit) / acceleration;
+}
+
+// returns one past the last newline, or begin if there is no complete line
+static const char *lastLineEnd(const char *begin, const char *end)
+{
+    for (const char *it = end; it != begin; --it) {
+        if (it[-1] == '\n')
+            return it;
+    }
+    return begin;
+}
+
+void GcodeParser::parse(QIODevice *device)
+{
+    // sequential fallback: parse complete lines block by block and carry the
+    // incomplete tail over to the next block
+    QByteArray buffer(BlockSize, Qt::Uninitialized);
+    qint64 offset = device->isSequential() ? 0 : device->pos();
+    int size = 0;
+    while (!m_atEnd) {
+        if (size == buffer.size())
+            buffer.resize(buffer.size() * 2); // a line longer than the buffer
+
+        const qint64 read = device->read(buffer.data() + size, buffer.size() - size);
+        if (read <= 0)
+            break;
+
+        size += read;
+        const char *begin = buffer.constData();
+        const char *end = begin + size;
+        const char *tail = lastLineEnd(begin, end);
+        setOrigin(begin, offset);
+        parse(begin, tail);
+        size = end - tail;
+        offset += tail - begin;
+        memmove(buffer.data(), tail, size);
+    }
+    setOrigin(buffer.constData(), offset);
+    parse(buffer.constData(), buffer.constData() + size);
+}
+
+void GcodeParser::setLayerRange(int first, int last)
+{
+    m_firstLayer = first;
+    m_lastLayer = last;
+}
+
+void GcodeParser::setTotalsEnabled(bool enabled)
+{
+    m_totalsEnabled = enabled;
+}
+
+void GcodeParser::setTravelsEnabled(bool enabled)
+{
+    m_travelsEnabled = enabled;
+}
+
+void GcodeParser::setLineMapEnabled(bool enabled)
+{
+    m_lineMapEnabled = enabled;
+}
+
+void GcodeParser::restore(const QVector<GcodeLayer> &layers, const QVector<QVector3D> &points,
+                          const QVector<quint32> &indices, const QVector<GcodeSegment> &segments,
+                          const QVector<QVector3D> &travels, const GcodeLineMap &lineMap,
+                          const GcodeTotals &totals)
+{
+    m_layers = layers;
+    m_points = points;
+    m_indices = indices;
+    m_segments = segments;
+    m_travels = travels;
+    m_lineMap = lineMap;
+    m_totals = totals;
+}
+
+void GcodeParser::setOrigin(const char *origin, qint64 offset)
+{
+    m_origin = origin;
+    m_originOffset = offset;
+}
+
+// continues from a previously indexed layer, returns the offset to continue at
+qint64 GcodeParser::seek(const QVector<GcodeLayer> &index, int layer)
+{
+    m_state = index.at(layer).state;
+    m_layers = index.mid(0, layer);
+    // the skipped layers have no vertices or travels
+    for (GcodeLayer &previous : m_layers) {
+        previous.index = 0;
+        previous.travel = 0;
+    }
+    m_lineCount = index.at(layer).line;
+    return index.at(layer).offset;
+}
+
+void GcodeParser::parse(const char *begin, const char *end)
+{
+    while (begin != end && !m_atEnd) {
+        const char *eol = static_cast<const char *>(memchr(begin, '\n', end - begin));
+        const char *next = eol ? eol + 1 : end;
+        m_line = begin;
+        parseLine(begin, eol ? eol : end);
+        ++m_lineCount;
+        if (Q_UNLIKELY(m_dependent || m_dirty))
+            resync(next);
+        begin = next;
+    }
+    updatePrintTime();
+}
+
+struct GcodeChunk
+{
+    const char *begin;
+    const char *end;
+    GcodeModes modes;
+    GcodeParser parser;
+};
+
+/*
+ * Splits the input into newline-aligned chunks that are parsed concurrently.
+ *
+ * The modal commands (G90/G91, M82/M83, T<n>) are collected in a quick first
+ * pass, so that each chunk starts with the exact modes. The position of the
+ * machine at the beginning of a chunk remains unknown (NaN) until the chunk
+ * sets it, and is substituted when the chunks are stitched together in order.
+ * Lines that depend on the unknown position in any other way (relative moves
+ * on unknown axes, or absolute extrusion from an unknown extruder position)
+ * are re-parsed with the exact state while stitching, so that the result is
+ * identical to parsing the whole input serially.
+ */
+void GcodeParser::parseConcurrent(const char *begin, const char *end)
+{
+    // a range of layers is parsed serially to stop reading after the range
+    const int threadCount = QThread::idealThreadCount();
+    const qint64 size = end - begin;
+    if (threadCount < 2 || size < 2 * MinChunkSize || m_firstLayer > 0 || m_lastLayer < INT_MAX) {
+        parse(begin, end);
+        return;
+    }
+
+    const qint64 chunkSize = qMax<qint64>(MinChunkSize, size / (threadCount * 4));
+    QVector<GcodeChunk> chunks;
+    while (begin != end) {
+        const char *it = begin + qMin(chunkSize, end - begin);
+        const char *eol = static_cast<const char *>(memchr(it - 1, '\n', end - it + 1));
+        const char *next = eol ? eol + 1 : end;
+        chunks += GcodeChunk{begin, next, GcodeModes(), GcodeParser()};
+        chunks.last().parser.m_totalsEnabled = m_totalsEnabled;
+        chunks.last().parser.m_planned = false;
+        chunks.last().parser.m_travelsEnabled = m_travelsEnabled;
+        chunks.last().parser.m_lineMapEnabled = m_lineMapEnabled;
+        begin = next;
+    }
+
+    QtConcurrent::blockingMap(chunks, [](GcodeChunk &chunk) {
+        chunk.modes = scanModes(chunk.begin, chunk.end);
+    });
+
+    GcodeState state = m_state;
+    for (GcodeChunk &chunk : chunks) {
+        chunk.parser.m_state = state;
+        chunk.parser.m_sync = chunk.begin;
+        chunk.parser.setOrigin(m_origin, m_originOffset);
+        state.apply(chunk.modes);
+        // the first chunk continues from the current (known) position
+        if (&chunk != &chunks.first()) {
+            chunk.parser.m_state.position = QVector3D(qQNaN(), qQNaN(), qQNaN());
+            chunk.parser.m_state.e = qQNaN();
+            chunk.parser.m_state.feedrate = qQNaN();
+        }
+    }
+
+    QtConcurrent::blockingMap(chunks, [](GcodeChunk &chunk) {
+        chunk.parser.parse(chunk.begin, chunk.end);
+    });
+
+    for (GcodeChunk &chunk : chunks) {
+        parse(chunk.begin, chunk.parser.m_sync);
+        stitch(chunk.parser);
+        chunk.parser = GcodeParser();
+    }
+    updatePrintTime();
+}
+
+GcodeModes GcodeParser::scanModes(const char *begin, const char *end)
+{
+    GcodeModes modes;
+    while (begin != end) {
+        const char *eol = static_cast<const char *>(memchr(begin, '\n', end - begin));
+        const char *next = eol ? eol + 1 : end;
+        const char *it = begin;
+        const char *lineEnd = eol ? eol : end;
+        char letter = 0;
+        float number = 0;
+        if (readCommand(it, lineEnd, &letter, &number)) {
+            if (letter == 'G' && (number == 90 || number == 91))
+                modes.relative = number == 91;
+            else if (letter == 'M' && (number == 82 || number == 83))
+                modes.relativeExtrusion = number == 83;
+            else if (letter == 'T')
+                modes.tool = static_cast<int>(number);
+            else if (letter == 'M' && number == 204)
+                modes.acceleration = readAcceleration(it, lineEnd, modes.acceleration);
+        }
+        begin = next;
+    }
+    return modes;
+}
+
+void GcodeState::apply(const GcodeModes &modes)
+{
+    if (modes.relative != -1)
+        relative = modes.relative;
+    if (modes.relativeExtrusion != -1)
+        relativeExtrusion = modes.relativeExtrusion;
+    if (modes.tool != -1)
+        tool = modes.tool;
+    if (modes.acceleration >= 0)
+        acceleration = modes.acceleration;
+}
+
+void GcodeParser::parseLine(const char *it, const char *end)
+{
+    char letter = 0;
+    float number = 0;
+    if (!readCommand(it, end, &letter, &number))
+        return;
+
+    switch (letter) {
+    case 'G':
+        if (number == 0 || number == 1)
+            parseMove(it, end);
+        else if (number == 90 || number == 91)
+            m_state.relative = number == 91;
+        else if (number == 92)
+            parseSetPosition(it, end);
+        break;
+    case 'M':
+        if (number == 82 || number == 83)
+            m_state.relativeExtrusion = number == 83;
+        else if (number == 204)
+            m_state.acceleration = readAcceleration(it, end, m_state.acceleration);
+        break;
+    case 'T':
+        m_state.tool = static_cast<int>(number);
+        break;
+    default:
+        break;
+    }
+}
+
+void GcodeParser::parseMove(const char *it, const char *end)
+{
+    bool ok = false;
+    float extrusion = 0;
+    const GcodeState before = m_state;
+    while ((it = skipSpaces(it, end)) != end) {
+        const char letter = *it++;
+        const float value = readFloat(it, end, &ok);
+        if (!ok) {
+            it = skipWord(it, end);
+            continue;
+        }
+        switch (letter) {
+        case 'X':
+        case 'Y':
+        case 'Z':
+            setAxis(letter - 'X', value);
+            break;
+        case 'E':
+            extrusion = extrude(value);
+            break;
+        case 'F':
+            m_state.feedrate = value;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (extrusion > 0)
+        appendSegment(before, m_state.position, extrusion);
+
+    if (m_atEnd || (m_layers.count() <= m_firstLayer && m_firstLayer > 0))
+        return;
+
+    // a move from (or to) the unknown entry position of a chunk is kept until
+    // the chunk is stitched, where it is dropped if it does not move
+    if (m_travelsEnabled && extrusion <= 0 && m_state.position != before.position)
+        m_travels << before.position << m_state.position;
+
+    if (m_totalsEnabled) {
+        const GcodeMove move{before.position, m_state.position, extrusion, m_state.feedrate,
+                             m_state.acceleration, m_state.tool, m_segments.count()};
+        // the moves of a chunk are added when the chunk is stitched, until
+        // its planner no longer depends on the entry state, which the moves
+        // without the unknown entry position or feedrate are planned to find
+        if (Q_LIKELY(m_planned)) {
+            addMove(move);
+        } else {
+            m_unresolvedMoves += move;
+            if (!qIsNaN(move.feedrate) && !qIsNaN((move.to - move.from).lengthSquared()))
+                planMove(move);
+        }
+    }
+}
+
+void GcodeParser::parseSetPosition(const char *it, const char *end)
+{
+    bool ok = false;
+    bool any = false;
+    while ((it = skipSpaces(it, end)) != end) {
+        const char letter = *it++;
+        const float value = readFloat(it, end, &ok);
+        if (!ok) {
+            it = skipWord(it, end);
+            continue;
+        }
+        switch (letter) {
+        case 'X':
+        case 'Y':
+        case 'Z':
+            m_state.position[letter - 'X'] = value;
+            m_dirty &= ~(1 << (letter - 'X'));
+            any = true;
+            break;
+        case 'E':
+            m_state.e = value;
+            any = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (!any) {
+        m_state.position = QVector3D();
+        m_state.e = 0;
+        m_dirty = 0;
+    }
+}
+
+void GcodeParser::setAxis(int axis, float value)
+{
+    if (!m_state.relative) {
+        m_state.position[axis] = value;
+        m_dirty &= ~(1 << axis);
+    } else {
+        if (qIsNaN(m_state.position[axis]))
+            m_dirty |= 1 << axis;
+        m_state.position[axis] += value;
+    }
+}
+
+// relative extrusion does not move the absolute extruder position, which
+// is only set by absolute extrusion (M82) and G92, returns the extruded length
+float GcodeParser::extrude(float e)
+{
+    if (m_state.relativeExtrusion)
+        return e;
+
+    if (qIsNaN(m_state.e))
+        m_dependent = true;
+    const float extrusion = e - m_state.e;
+    m_state.e = e;
+    return extrusion;
+}
+
+// a new layer starts whenever the height of extrusion changes
+void GcodeParser::appendSegment(const GcodeState &before, const QVector3D &to, float extrusion)
+{
+    if (m_layers.isEmpty() || !sameLayer(m_layers.last().z, to.z())) {
+        if (m_layers.count() > m_lastLayer) {
+            m_atEnd = true;
+            return;
+        }
+        m_layers += GcodeLayer{to.z(), m_indices.count(), m_travels.count(), lineOffset(), m_lineCount, before};
+    }
+
+    if (m_layers.count() <= m_firstLayer)
+        return;
+
+    if (!isContinuous(before.position))
+        appendVertex(before.position);
+    m_indices += m_points.count() - 1;
+    appendVertex(to);
+    m_indices += m_points.count() - 1;
+
+    m_segments += GcodeSegment{m_state.feedrate, extrusion, m_state.tool, 0};
+    if (m_lineMapEnabled)
+        m_lineMap.append(m_lineCount);
+    if (Q_UNLIKELY(qIsNaN(m_state.feedrate)))
+        m_unresolvedFeedrate = m_segments.count();
+}
+
+void GcodeParser::addMove(const GcodeMove &move)
+{
+    planMove(move);
+
+    const float distance = move.from.distanceToPoint(move.to);
+    if (move.extrusion > 0)
+        m_totals.extrusionDistance += distance;
+    else
+        m_totals.travelDistance += distance;
+
+    if (move.extrusion != 0 && move.tool >= 0) {
+        if (move.tool >= m_totals.extrusion.count())
+            m_totals.extrusion.resize(move.tool + 1);
+        m_totals.extrusion[move.tool] += move.extrusion;
+    }
+}
+
+void GcodeParser::planMove(const GcodeMove &move)
+{
+    // extrusion without moving takes as long as moving the extrusion
+    const QVector3D delta = move.to - move.from;
+    const float distance = delta.length();
+    const float length = distance > 0 ? distance : qAbs(move.extrusion);
+    if (length <= 0 || move.feedrate <= 0)
+        return;
+
+    GcodePlannedMove planned;
+    planned.direction = distance > 0 ? delta / distance : QVector3D();
+    planned.length = length;
+    planned.speed = move.feedrate / 60;
+    planned.acceleration = move.acceleration;
+    planned.maxEntrySpeed = m_planner.isEmpty() ? 0 : junctionSpeed(m_planner.last(), planned);
+    planned.entrySpeed = 0;
+    planned.segments = move.segments;
+    m_planner += planned;
+
+    // backward pass: the moves must be able to stop at the end of the queue,
+    // the entry speeds only increase until one no longer changes
+    float exit = 0;
+    for (int i = m_planner.count() - 1; i > 0; --i) {
+        GcodePlannedMove &next = m_planner[i];
+        const float entry = qMin(next.maxEntrySpeed, reachableSpeed(next, exit));
+        if (entry == next.entrySpeed && i < m_planner.count() - 1)
+            break;
+        next.entrySpeed = exit = entry;
+    }
+
+    if (m_planner.count() > PlannerQueueSize)
+        finishMove();
+}
+
+// forward pass: the first move of the queue exits as fast as it can
+// accelerate to, and as fast as the next move can enter
+void GcodeParser::finishMove()
+{
+    const GcodePlannedMove &move = m_planner.first();
+    const float next = m_planner.at(1).entrySpeed;
+    const float exit = qMin(next, reachableSpeed(move, move.entrySpeed));
+    m_plannedTime += moveTime(move, move.entrySpeed, exit);
+    for (; m_timedSegments < move.segments; ++m_timedSegments)
+        m_segments[m_timedSegments].time = m_plannedTime;
+
+    // the planner of a chunk continues like the planner of a serial parse
+    // once the exit speed does not depend on the entry speed of the chunk
+    if (!m_planned && next <= reachableSpeed(move, 0)) {
+        m_planned = true;
+        m_plannedTime = 0;
+    }
+
+    m_planner.removeFirst();
+    m_planner.first().entrySpeed = exit;
+}
+
+void GcodeParser::updatePrintTime()
+{
+    if (!m_totalsEnabled)
+        return;
+
+    double time = m_plannedTime;
+    int segment = m_timedSegments;
+    float entry = m_planner.isEmpty() ? 0 : m_planner.first().entrySpeed;
+    for (int i = 0; i < m_planner.count(); ++i) {
+        const GcodePlannedMove &move = m_planner.at(i);
+        const float next = i + 1 < m_planner.count() ? m_planner.at(i + 1).entrySpeed : 0;
+        const float exit = qMin(next, reachableSpeed(move, entry));
+        time += moveTime(move, entry, exit);
+        for (; segment < move.segments; ++segment)
+            m_segments[segment].time = time;
+        entry = exit;
+    }
+    for (; segment < m_segments.count(); ++segment)
+        m_segments[segment].time = time;
+    m_totals.printTime = time;
+}
+
+void GcodeTotals::add(const GcodeTotals &other)
+{
+    printTime += other.printTime;
+    travelDistance += other.travelDistance;
+    extrusionDistance += other.extrusionDistance;
+    if (extrusion.count() < other.extrusion.count())
+        extrusion.resize(other.extrusion.count());
+    for (int tool = 0; tool < other.extrusion.count(); ++tool)
+        extrusion[tool] += other.extrusion.at(tool);
+}
+
+// whether a segment continues the path from the last vertex
+bool GcodeParser::isContinuous(const QVector3D &from)
+{
+    if (m_points.isEmpty())
+        return false;
+
+    const QVector3D &last = m_points.last();
+    for (int axis = 0; axis < 3; ++axis) {
+        if (last[axis] == from[axis] || (qIsNaN(last[axis]) && qIsNaN(from[axis])))
+            continue;
+        // an unknown entry coordinate of a chunk may or may not match
+        if (qIsNaN(last[axis]) || qIsNaN(from[axis]))
+            m_dependent = true;
+        return false;
+    }
+    return true;
+}
+
+void GcodeParser::appendVertex(const QVector3D &vertex)
+{
+    m_points += vertex;
+    for (int axis = 0; axis < 3; ++axis) {
+        if (Q_UNLIKELY(qIsNaN(vertex[axis])))
+            m_unresolved[axis] = m_points.count();
+    }
+}
+
+// discards the output of a chunk up to a line that depended on its unknown
+// entry state, the lines before are re-parsed in order when stitching
+void GcodeParser::resync(const char *next)
+{
+    m_dependent = false;
+    m_points.clear();
+    m_indices.clear();
+    m_layers.clear();
+    m_segments.clear();
+    m_travels.clear();
+    m_lineMap.clear();
+    m_lineCount = 0;
+    std::fill_n(m_unresolved, 3, 0);
+    m_unresolvedFeedrate = 0;
+    m_totals = GcodeTotals();
+    m_planner.clear();
+    m_plannedTime = 0;
+    m_timedSegments = 0;
+    m_unresolvedMoves.clear();
+    m_planned = false;
+    m_sync = next;
+}
+
+// substitutes the unknown (NaN) entry position of a chunk
+static void resolve(GcodeState &state, const GcodeState &entry)
+{
+    for (int axis = 0; axis < 3; ++axis) {
+        if (qIsNaN(state.position[axis]))
+            state.position[axis] = entry.position[axis];
+    }
+    if (qIsNaN(state.e))
+        state.e = entry.e;
+    if (qIsNaN(state.feedrate))
+        state.feedrate = entry.feedrate;
+}
+
+// appends a chunk that continues from the current state
+void GcodeParser::stitch(const GcodeParser &chunk)
+{
+    if (!chunk.m_points.isEmpty()) {
+        QVector3D first = chunk.m_points.first();
+        for (int axis = 0; axis < 3; ++axis) {
+            if (chunk.m_unresolved[axis] > 0)
+                first[axis] = m_state.position[axis];
+        }
+
+        // continue the path from the last vertex like a serial parse would
+        const int skip = !m_points.isEmpty() && m_points.last() == first ? 1 : 0;
+        const int count = m_points.count();
+        const int offset = count - skip;
+        m_points.resize(offset + chunk.m_points.count());
+        std::copy(chunk.m_points.cbegin() + skip, chunk.m_points.cend(), m_points.begin() + count);
+        for (int axis = 0; axis < 3; ++axis) {
+            for (int i = skip; i < chunk.m_unresolved[axis]; ++i)
+                m_points[offset + i][axis] = m_state.position[axis];
+        }
+
+        const int indexOffset = m_indices.count();
+        m_indices.resize(indexOffset + chunk.m_indices.count());
+        std::transform(chunk.m_indices.cbegin(), chunk.m_indices.cend(), m_indices.begin() + indexOffset,
+                       [offset](quint32 index) { return index + offset; });
+
+        const int segmentOffset = m_segments.count();
+        m_segments += chunk.m_segments;
+        m_lineMap.append(chunk.m_lineMap, m_lineCount);
+        for (int i = 0; i < chunk.m_unresolvedFeedrate; ++i)
+            m_segments[segmentOffset + i].feedrate = m_state.feedrate;
+    }
+
+    // only the leading travels of a chunk can be dropped
+    const int travelOffset = m_travels.count();
+    QVector<int> droppedTravels;
+    for (int i = 0; i < chunk.m_travels.count(); i += 2) {
+        QVector3D from = chunk.m_travels.at(i);
+        QVector3D to = chunk.m_travels.at(i + 1);
+        for (int axis = 0; axis < 3; ++axis) {
+            if (qIsNaN(from[axis]))
+                from[axis] = m_state.position[axis];
+            if (qIsNaN(to[axis]))
+                to[axis] = m_state.position[axis];
+        }
+        if (from == to)
+            droppedTravels += i;
+        else
+            m_travels << from << to;
+    }
+
+    const int indexOffset = m_indices.count() - chunk.m_indices.count();
+    for (GcodeLayer layer : chunk.m_layers) {
+        if (qIsNaN(layer.z))
+            layer.z = m_state.position.z();
+        if (m_layers.isEmpty() || !sameLayer(m_layers.last().z, layer.z)) {
+            layer.index += indexOffset;
+            const int dropped = std::count_if(droppedTravels.cbegin(), droppedTravels.cend(),
+                                              [&layer](int travel) { return travel < layer.travel; });
+            layer.travel += travelOffset - 2 * dropped;
+            layer.line += m_lineCount;
+            resolve(layer.state, m_state);
+            m_layers += layer;
+        }
+    }
+
+    // the leading moves of the chunk leave the queue in the same state as the
+    // planner of the chunk had when it took over, the times of the segments
+    // after that are relative to the moves that left the queue before
+    const int segmentOffset = m_segments.count() - chunk.m_segments.count();
+    for (GcodeMove move : chunk.m_unresolvedMoves) {
+        for (int axis = 0; axis < 3; ++axis) {
+            if (qIsNaN(move.from[axis]))
+                move.from[axis] = m_state.position[axis];
+            if (qIsNaN(move.to[axis]))
+                move.to[axis] = m_state.position[axis];
+        }
+        if (qIsNaN(move.feedrate))
+            move.feedrate = m_state.feedrate;
+        move.segments += segmentOffset;
+        addMove(move);
+    }
+    if (chunk.m_planned && m_totalsEnabled) {
+        for (int segment = m_timedSegments; segment < segmentOffset + chunk.m_timedSegments; ++segment)
+            m_segments[segment].time += m_plannedTime;
+        m_plannedTime += chunk.m_plannedTime;
+        m_timedSegments = segmentOffset + chunk.m_timedSegments;
+        m_planner = chunk.m_planner;
+        for (GcodePlannedMove &move : m_planner)
+            move.segments += segmentOffset;
+    }
+    m_totals.add(chunk.m_totals);
+    m_lineCount += chunk.m_lineCount;
+
+    GcodeState state = chunk.m_state;
+    resolve(state, m_state);
+    m_state = state;
+}
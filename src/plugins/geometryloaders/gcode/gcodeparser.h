@@ -0,0 +1,239 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#ifndef GCODEPARSER_H
+#define GCODEPARSER_H
+
+#include <QtCore/qvector.h>
+#include <QtGui/qvector3d.h>
+
+#include <climits>
+
+#include "gcodelinemap.h"
+
+QT_FORWARD_DECLARE_CLASS(QIODevice)
+
+// modal commands seen in a range of lines, -1 if not seen
+struct GcodeModes
+{
+    int relative = -1; // G90/G91
+    int relativeExtrusion = -1; // M82/M83
+    int tool = -1; // T<n>
+    float acceleration = -1; // M204
+};
+
+struct GcodeState
+{
+    QVector3D position;
+    float e = 0; // absolute extruder position, see M82
+    float feedrate = 0; // mm/min
+    float acceleration = 1000; // mm/s^2
+    bool relative = false;
+    bool relativeExtrusion = true;
+    int tool = 0;
+
+    void apply(const GcodeModes &modes);
+};
+
+struct GcodeLayer
+{
+    float z;
+    int index; // first index of the layer
+    int travel; // first travel vertex of the layer
+    qint64 offset; // first line of the layer
+    int line; // number of the first line (from 0)
+    GcodeState state; // machine state before the first line
+};
+Q_DECLARE_TYPEINFO(GcodeLayer, Q_MOVABLE_TYPE);
+
+// the values of a line segment (a pair of indices)
+struct GcodeSegment
+{
+    float feedrate; // mm/min
+    float extrusion; // extruded length
+    int tool;
+    float time; // estimated print time at the end (s), with totals enabled
+};
+Q_DECLARE_TYPEINFO(GcodeSegment, Q_PRIMITIVE_TYPE);
+
+// the totals of the moves in the layers in range
+struct GcodeTotals
+{
+    double printTime = 0; // s
+    double travelDistance = 0; // mm, moves without extrusion
+    double extrusionDistance = 0; // mm, moves with extrusion
+    QVector<double> extrusion; // net extruded length per tool
+
+    void add(const GcodeTotals &other);
+};
+
+// a leading move of a chunk, added to the totals once the entry state is known
+struct GcodeMove
+{
+    QVector3D from;
+    QVector3D to;
+    float extrusion;
+    float feedrate;
+    float acceleration;
+    int tool;
+    int segments; // the segment count after the move
+};
+Q_DECLARE_TYPEINFO(GcodeMove, Q_PRIMITIVE_TYPE);
+
+// a move in the look-ahead queue of the print time estimate
+struct GcodePlannedMove
+{
+    QVector3D direction; // unit vector, null for extrusion without moving
+    float length; // mm
+    float speed; // nominal speed (mm/s)
+    float acceleration; // mm/s^2
+    float maxEntrySpeed; // at the junction with the previous move
+    float entrySpeed; // fastest that can still stop at the end of the queue, or fixed for the first
+    int segments; // the segment count after the move
+};
+Q_DECLARE_TYPEINFO(GcodePlannedMove, Q_PRIMITIVE_TYPE);
+
+/*
+ * Tokenizes G-code in place, straight from a (memory-mapped) character
+ * range, without allocating anything per line.
+ *
+ * Extruding moves are emitted as indexed line segments (pairs of indices).
+ * Continuous paths share the vertex between consecutive segments. The
+ * feedrate, extrusion and tool of each segment are collected in the same pass,
+ * and optionally the totals of all moves, with a print time estimate, and the
+ * moves without extrusion as pairs of travel vertices, and the line number
+ * of each segment (see GcodeLineMap).
+ */
+class GcodeParser
+{
+public:
+    GcodeParser() = default;
+    explicit GcodeParser(const GcodeState &state) : m_state(state) { }
+
+    void parse(QIODevice *device);
+    void parse(const char *begin, const char *end);
+    void parseConcurrent(const char *begin, const char *end);
+
+    void setLayerRange(int first, int last);
+    void setTotalsEnabled(bool enabled);
+    void setTravelsEnabled(bool enabled);
+    bool travelsEnabled() const { return m_travelsEnabled; }
+    void setLineMapEnabled(bool enabled);
+    bool lineMapEnabled() const { return m_lineMapEnabled; }
+    bool atEnd() const { return m_atEnd; }
+
+    void setOrigin(const char *origin, qint64 offset);
+    qint64 seek(const QVector<GcodeLayer> &index, int layer);
+
+    static GcodeModes scanModes(const char *begin, const char *end);
+    static float readFloat(const char *&it, const char *end, bool *ok);
+
+    // the output of a previous parse of a whole file, see GcodeCache
+    void restore(const QVector<GcodeLayer> &layers, const QVector<QVector3D> &points,
+                 const QVector<quint32> &indices, const QVector<GcodeSegment> &segments,
+                 const QVector<QVector3D> &travels, const GcodeLineMap &lineMap,
+                 const GcodeTotals &totals);
+
+    const QVector<GcodeLayer> &layers() const { return m_layers; }
+    const QVector<QVector3D> &points() const { return m_points; }
+    const QVector<quint32> &indices() const { return m_indices; }
+    const QVector<GcodeSegment> &segments() const { return m_segments; }
+    const QVector<QVector3D> &travels() const { return m_travels; }
+    const GcodeLineMap &lineMap() const { return m_lineMap; }
+    const GcodeTotals &totals() const { return m_totals; }
+
+    // the leading segments whose time no longer changes as parsing continues
+    int timedSegmentCount() const { return m_timedSegments; }
+
+    QVector<GcodeLayer> takeLayers() { return std::move(m_layers); }
+    QVector<QVector3D> takePoints() { return std::move(m_points); }
+    QVector<quint32> takeIndices() { return std::move(m_indices); }
+    QVector<GcodeSegment> takeSegments() { return std::move(m_segments); }
+
+private:
+    void parseLine(const char *begin, const char *end);
+    void parseMove(const char *begin, const char *end);
+    void parseSetPosition(const char *begin, const char *end);
+    void setAxis(int axis, float value);
+    float extrude(float e);
+    void appendSegment(const GcodeState &before, const QVector3D &to, float extrusion);
+    bool isContinuous(const QVector3D &from);
+    void appendVertex(const QVector3D &vertex);
+    void addMove(const GcodeMove &move);
+    void planMove(const GcodeMove &move);
+    void finishMove();
+    void updatePrintTime();
+    void resync(const char *next);
+    void stitch(const GcodeParser &chunk);
+
+    GcodeState m_state;
+
+    // file offset and number of the current line
+    qint64 lineOffset() const { return m_originOffset + (m_line - m_origin); }
+    const char *m_line = nullptr;
+    int m_lineCount = 0;
+    const char *m_origin = nullptr;
+    qint64 m_originOffset = 0;
+
+    // only the vertices of the layers in range are emitted, and parsing ends
+    // after the last layer
+    int m_firstLayer = 0;
+    int m_lastLayer = INT_MAX;
+    bool m_atEnd = false;
+
+    bool m_totalsEnabled = false;
+    GcodeTotals m_totals;
+
+    // moves wait in a look-ahead queue, like in the firmware, until their
+    // exit speed is known, the print time of the moves still in the queue
+    // is estimated as if the machine stops after the last one
+    QVector<GcodePlannedMove> m_planner;
+    double m_plannedTime = 0;
+    int m_timedSegments = 0;
+
+    bool m_travelsEnabled = false;
+    QVector<QVector3D> m_travels;
+
+    bool m_lineMapEnabled = false;
+    GcodeLineMap m_lineMap;
+
+    // chunk parsing: whether the output depends on the unknown entry state in
+    // a way that cannot be substituted afterwards, the axes moved relatively
+    // from an unknown position, the leading vertices per axis and the leading
+    // segments that still need the entry position and feedrate substituted,
+    // the moves that are added to the totals once the entry state is known,
+    // whether the planner no longer depends on the moves before the chunk,
+    // and where the output of the chunk starts (its line numbers start from 0)
+    bool m_dependent = false;
+    int m_dirty = 0;
+    int m_unresolved[3] = { 0, 0, 0 };
+    int m_unresolvedFeedrate = 0;
+    QVector<GcodeMove> m_unresolvedMoves;
+    bool m_planned = true;
+    const char *m_sync = nullptr;
+
+    QVector<GcodeLayer> m_layers;
+    QVector<QVector3D> m_points;
+    QVector<quint32> m_indices;
+    QVector<GcodeSegment> m_segments;
+};
+
+#endif // GCODEPARSER_H
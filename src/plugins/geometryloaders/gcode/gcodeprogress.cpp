@@ -0,0 +1,77 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#include "gcodeprogress.h"
+
+GcodeProgress::GcodeProgress(qint64 bytesTotal, QObject *parent)
+    : QObject(parent),
+      m_bytesTotal(bytesTotal)
+{
+}
+
+GcodeProgress::~GcodeProgress()
+{
+    m_canceled = true;
+    m_future.waitForFinished();
+}
+
+qint64 GcodeProgress::bytesLoaded() const
+{
+    return m_bytesLoaded;
+}
+
+qint64 GcodeProgress::bytesTotal() const
+{
+    return m_bytesTotal;
+}
+
+int GcodeProgress::layerCount() const
+{
+    return m_layerCount;
+}
+
+bool GcodeProgress::isFinished() const
+{
+    return m_finished;
+}
+
+void GcodeProgress::setProgress(qint64 bytesLoaded, int layerCount, bool finished)
+{
+    m_bytesLoaded = bytesLoaded;
+    m_layerCount = layerCount;
+    emit progressChanged();
+
+    if (finished && !m_finished) {
+        m_finished = true;
+        emit finished();
+    }
+}
+
+void GcodeProgress::setFuture(const QFuture<void> &future)
+{
+    m_future = future;
+}
+
+bool GcodeProgress::isCanceled() const
+{
+    return m_canceled;
+}
@@ -0,0 +1,69 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#ifndef GCODEPROGRESS_H
+#define GCODEPROGRESS_H
+
+#include <QtCore/qfuture.h>
+#include <QtCore/qobject.h>
+
+#include <atomic>
+
+// the progress of a geometry that continues loading in the background, set
+// in the thread of the geometry whenever the loading thread publishes more
+class GcodeProgress : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(qint64 bytesLoaded READ bytesLoaded NOTIFY progressChanged FINAL)
+    Q_PROPERTY(qint64 bytesTotal READ bytesTotal CONSTANT FINAL)
+    Q_PROPERTY(int layerCount READ layerCount NOTIFY progressChanged FINAL)
+    Q_PROPERTY(bool finished READ isFinished NOTIFY finished FINAL)
+
+public:
+    explicit GcodeProgress(qint64 bytesTotal, QObject *parent = nullptr);
+    ~GcodeProgress() override;
+
+    qint64 bytesLoaded() const;
+    qint64 bytesTotal() const;
+    int layerCount() const;
+    bool isFinished() const;
+
+    void setProgress(qint64 bytesLoaded, int layerCount, bool finished);
+
+    // the loading thread stops when the geometry is destroyed
+    void setFuture(const QFuture<void> &future);
+    bool isCanceled() const;
+
+signals:
+    void progressChanged();
+    void finished();
+
+private:
+    qint64 m_bytesLoaded = 0;
+    qint64 m_bytesTotal = 0;
+    int m_layerCount = 0;
+    bool m_finished = false;
+    std::atomic_bool m_canceled { false };
+    QFuture<void> m_future;
+};
+
+#endif // GCODEPROGRESS_H
@@ -0,0 +1,131 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#include "gcodesimplifier.h"
+
+#include <QtCore/qpair.h>
+
+#include <algorithm>
+
+// vertices closer than this (mm) to the simplified path are collinear
+static const float CollinearTolerance = 1e-4f;
+
+static float distanceToSegment(const QVector3D &point, const QVector3D &from, const QVector3D &to)
+{
+    const QVector3D direction = to - from;
+    const float lengthSquared = direction.lengthSquared();
+    if (lengthSquared == 0)
+        return point.distanceToPoint(from);
+    const float t = qBound(0.0f, QVector3D::dotProduct(point - from, direction) / lengthSquared, 1.0f);
+    return point.distanceToPoint(from + t * direction);
+}
+
+// marks the vertices of a polyline that are kept, the first and the last
+// are always kept
+void GcodeSimplifier::decimate(const QVector3D *points, int count, float tolerance, QVector<bool> &keep)
+{
+    keep.fill(false, count);
+    keep[0] = keep[count - 1] = true;
+
+    QVector<QPair<int, int>> stack;
+    stack += qMakePair(0, count - 1);
+    while (!stack.isEmpty()) {
+        const QPair<int, int> range = stack.takeLast();
+        float maxDistance = 0;
+        int farthest = -1;
+        for (int i = range.first + 1; i < range.second; ++i) {
+            const float distance = distanceToSegment(points[i], points[range.first], points[range.second]);
+            if (distance > maxDistance) {
+                maxDistance = distance;
+                farthest = i;
+            }
+        }
+        if (farthest != -1 && maxDistance > tolerance) {
+            keep[farthest] = true;
+            stack += qMakePair(range.first, farthest);
+            stack += qMakePair(farthest, range.second);
+        }
+    }
+}
+
+void GcodeSimplifier::simplify(float tolerance, QVector<GcodeLayer> &layers, QVector<QVector3D> &points,
+                               QVector<quint32> &indices, QVector<GcodeSegment> &segments)
+{
+    tolerance = qMax(tolerance, CollinearTolerance);
+
+    QVector<QVector3D> simplifiedPoints;
+    QVector<quint32> simplifiedIndices;
+    QVector<GcodeSegment> simplifiedSegments;
+    simplifiedPoints.reserve(points.count());
+    simplifiedIndices.reserve(indices.count());
+    simplifiedSegments.reserve(segments.count());
+
+    QVector<QVector3D> run;
+    QVector<bool> keep;
+    quint32 lastIndex = UINT_MAX; // the last vertex of the previous run
+    int layer = 0;
+    const int count = segments.count();
+    for (int first = 0; first < count; ) {
+        // the layers start at the run that starts them
+        while (layer < layers.count() && layers.at(layer).index / 2 <= first)
+            layers[layer++].index = simplifiedIndices.count();
+        const int layerEnd = layer < layers.count() ? layers.at(layer).index / 2 : count;
+
+        int last = first + 1;
+        while (last < layerEnd && indices.at(2 * last) == indices.at(2 * last - 1)
+               && segments.at(last).tool == segments.at(first).tool
+               && segments.at(last).feedrate == segments.at(first).feedrate) {
+            ++last;
+        }
+
+        run.resize(0);
+        run += points.at(indices.at(2 * first));
+        for (int i = first; i < last; ++i)
+            run += points.at(indices.at(2 * i + 1));
+        decimate(run.constData(), run.count(), tolerance, keep);
+
+        if (indices.at(2 * first) != lastIndex)
+            simplifiedPoints += run.first();
+        GcodeSegment segment = segments.at(first);
+        segment.extrusion = 0;
+        for (int i = 1; i < run.count(); ++i) {
+            segment.extrusion += segments.at(first + i - 1).extrusion;
+            segment.time = segments.at(first + i - 1).time;
+            if (!keep.at(i))
+                continue;
+            simplifiedIndices += simplifiedPoints.count() - 1;
+            simplifiedPoints += run.at(i);
+            simplifiedIndices += simplifiedPoints.count() - 1;
+            simplifiedSegments += segment;
+            segment.extrusion = 0;
+        }
+
+        lastIndex = indices.at(2 * last - 1);
+        first = last;
+    }
+    while (layer < layers.count())
+        layers[layer++].index = simplifiedIndices.count();
+
+    points = simplifiedPoints;
+    indices = simplifiedIndices;
+    segments = simplifiedSegments;
+}
@@ -0,0 +1,49 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#ifndef GCODESIMPLIFIER_H
+#define GCODESIMPLIFIER_H
+
+#include <QtCore/qvector.h>
+#include <QtGui/qvector3d.h>
+
+#include "gcodeparser.h"
+
+/*
+ * Simplifies the extrusion paths of a toolpath for previews.
+ *
+ * Each run of continuous segments within a layer, with the same tool and
+ * feedrate, is decimated with Douglas-Peucker: a vertex is dropped when it
+ * is within the tolerance of the simplified path. Collinear vertices are
+ * always dropped. The extrusion of merged segments is summed up.
+ */
+class GcodeSimplifier
+{
+public:
+    static void simplify(float tolerance, QVector<GcodeLayer> &layers, QVector<QVector3D> &points,
+                         QVector<quint32> &indices, QVector<GcodeSegment> &segments);
+
+private:
+    static void decimate(const QVector3D *points, int count, float tolerance, QVector<bool> &keep);
+};
+
+#endif // GCODESIMPLIFIER_H
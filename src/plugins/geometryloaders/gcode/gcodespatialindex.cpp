@@ -0,0 +1,300 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#include "gcodespatialindex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+static const int SegmentsPerCell = 4;
+
+static float distanceToSegment(const QVector3D &point, const QVector3D &from, const QVector3D &to)
+{
+    const QVector3D direction = to - from;
+    const float lengthSquared = direction.lengthSquared();
+    const float t = lengthSquared > 0 ? qBound(0.0f, QVector3D::dotProduct(point - from, direction) / lengthSquared, 1.0f)
+                                      : 0.0f;
+    return point.distanceToPoint(from + t * direction);
+}
+
+// clips the segment to the rectangle (Liang-Barsky)
+static bool intersects(const QRectF &rect, const QVector3D &from, const QVector3D &to)
+{
+    const qreal dx = to.x() - from.x();
+    const qreal dy = to.y() - from.y();
+    const qreal p[] = { -dx, dx, -dy, dy };
+    const qreal q[] = { from.x() - rect.left(), rect.right() - from.x(), from.y() - rect.top(), rect.bottom() - from.y() };
+    qreal t0 = 0;
+    qreal t1 = 1;
+    for (int i = 0; i < 4; ++i) {
+        if (p[i] == 0) {
+            if (q[i] < 0)
+                return false;
+        } else {
+            const qreal t = q[i] / p[i];
+            if (p[i] < 0)
+                t0 = qMax(t0, t);
+            else
+                t1 = qMin(t1, t);
+            if (t0 > t1)
+                return false;
+        }
+    }
+    return true;
+}
+
+GcodeSpatialGrid::GcodeSpatialGrid(const GcodeParser &parser, int tool)
+    : m_layers(parser.layers()),
+      m_points(parser.points()),
+      m_indices(parser.indices()),
+      m_lineMap(parser.lineMap())
+{
+    const QVector<GcodeSegment> &segments = parser.segments();
+    m_grids.reserve(m_layers.count());
+    m_cellSegments.reserve(segments.count() * 2);
+    m_cellStarts += 0;
+    for (int i = 0; i < m_layers.count(); ++i) {
+        const int first = m_layers.at(i).index / 2;
+        const int last = i + 1 < m_layers.count() ? m_layers.at(i + 1).index / 2 : segments.count();
+        build(segments, first, last, tool, m_layers.at(i).z);
+    }
+
+    m_layersByZ.resize(m_grids.count());
+    std::iota(m_layersByZ.begin(), m_layersByZ.end(), 0);
+    std::stable_sort(m_layersByZ.begin(), m_layersByZ.end(),
+                     [this](int a, int b) { return m_grids.at(a).z < m_grids.at(b).z; });
+}
+
+// the grid of a layer, with square cells over the bounds of the segments of
+// the tool, or of all tools if negative
+void GcodeSpatialGrid::build(const QVector<GcodeSegment> &segments, int first, int last, int tool, float z)
+{
+    QVector<int> selected;
+    float left = std::numeric_limits<float>::max();
+    float top = std::numeric_limits<float>::max();
+    float right = std::numeric_limits<float>::lowest();
+    float bottom = std::numeric_limits<float>::lowest();
+    for (int i = first; i < last; ++i) {
+        if (tool >= 0 && segments.at(i).tool != tool)
+            continue;
+        selected += i;
+        for (int j = 2 * i; j < 2 * i + 2; ++j) {
+            const QVector3D &point = m_points.at(m_indices.at(j));
+            left = qMin(left, point.x());
+            top = qMin(top, point.y());
+            right = qMax(right, point.x());
+            bottom = qMax(bottom, point.y());
+        }
+    }
+
+    Grid grid = { z, 0, 0, 1, 1, 1, m_cellStarts.count() - 1 };
+    if (!selected.isEmpty()) {
+        const float width = right - left;
+        const float height = bottom - top;
+        const int cells = qMax(1, selected.count() / SegmentsPerCell);
+        // thin layers are split along their length only
+        const float cellSize = qMax(std::sqrt(width * height / cells), qMax(width, height) / cells);
+        grid.left = left;
+        grid.top = top;
+        grid.cellSize = cellSize > 0 ? cellSize : 1;
+        grid.columns = int(width / grid.cellSize) + 1;
+        grid.rows = int(height / grid.cellSize) + 1;
+    }
+
+    // counts the segments of each cell, and lists them in a second pass
+    const int cellCount = grid.columns * grid.rows;
+    QVector<int> starts(cellCount + 1, 0);
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int segment : qAsConst(selected)) {
+            const QVector3D &from = m_points.at(m_indices.at(2 * segment));
+            const QVector3D &to = m_points.at(m_indices.at(2 * segment + 1));
+            const QRect cells = cellsOf(grid, qMin(from.x(), to.x()), qMin(from.y(), to.y()),
+                                        qMax(from.x(), to.x()), qMax(from.y(), to.y()));
+            for (int y = cells.top(); y <= cells.bottom(); ++y) {
+                for (int x = cells.left(); x <= cells.right(); ++x) {
+                    const int cell = y * grid.columns + x;
+                    if (pass == 0)
+                        ++starts[cell + 1];
+                    else
+                        m_cellSegments[starts[cell]++] = segment;
+                }
+            }
+        }
+
+        if (pass == 0) {
+            starts[0] = m_cellSegments.count();
+            std::partial_sum(starts.begin(), starts.end(), starts.begin());
+            m_cellSegments.resize(starts.last());
+            m_cellStarts += starts.mid(1);
+        } else {
+            m_grids += grid;
+        }
+    }
+}
+
+// the cells that overlap a rectangle from above, or an empty rectangle
+QRect GcodeSpatialGrid::cellsOf(const Grid &grid, float left, float top, float right, float bottom) const
+{
+    const float width = grid.columns * grid.cellSize;
+    const float height = grid.rows * grid.cellSize;
+    if (right < grid.left || bottom < grid.top || left > grid.left + width || top > grid.top + height)
+        return QRect();
+
+    const auto cell = [&grid](float value, float origin, int count) {
+        return int(qBound(0.0f, std::floor((value - origin) / grid.cellSize), float(count - 1)));
+    };
+    return QRect(QPoint(cell(left, grid.left, grid.columns), cell(top, grid.top, grid.rows)),
+                 QPoint(cell(right, grid.left, grid.columns), cell(bottom, grid.top, grid.rows)));
+}
+
+// the segment nearest to a point in model space, within a distance, or -1
+int GcodeSpatialGrid::nearestSegment(const QVector3D &point, float maxDistance) const
+{
+    int nearest = -1;
+    float nearestDistance = maxDistance;
+    // the layers are searched outwards from the height of the point, until
+    // the rest are further above or below it than the nearest segment
+    const auto first = m_layersByZ.cbegin();
+    const auto last = m_layersByZ.cend();
+    auto above = std::lower_bound(first, last, point.z(),
+                                  [this](int layer, float z) { return m_grids.at(layer).z < z; });
+    auto below = above;
+    while (above != last || below != first) {
+        const float aboveDistance = above != last ? m_grids.at(*above).z - point.z()
+                                                  : std::numeric_limits<float>::infinity();
+        const float belowDistance = below != first ? point.z() - m_grids.at(*(below - 1)).z
+                                                   : std::numeric_limits<float>::infinity();
+        if (qMin(aboveDistance, belowDistance) > nearestDistance)
+            break;
+
+        const Grid &grid = m_grids.at(aboveDistance <= belowDistance ? *above++ : *--below);
+        const QRect cells = cellsOf(grid, point.x() - nearestDistance, point.y() - nearestDistance,
+                                    point.x() + nearestDistance, point.y() + nearestDistance);
+        for (int y = cells.top(); y <= cells.bottom(); ++y) {
+            for (int x = cells.left(); x <= cells.right(); ++x) {
+                const int cell = grid.firstCell + y * grid.columns + x;
+                for (int i = m_cellStarts.at(cell); i < m_cellStarts.at(cell + 1); ++i) {
+                    const int segment = m_cellSegments.at(i);
+                    const float distance = distanceToSegment(point, m_points.at(m_indices.at(2 * segment)),
+                                                             m_points.at(m_indices.at(2 * segment + 1)));
+                    // ties go to the first segment, whichever layer is searched first
+                    if (distance < nearestDistance
+                            || (distance == nearestDistance && (nearest == -1 || segment < nearest))) {
+                        nearest = segment;
+                        nearestDistance = distance;
+                    }
+                }
+            }
+        }
+    }
+    return nearest;
+}
+
+// the segments of a layer that cross a rectangle from above, in order
+QVector<int> GcodeSpatialGrid::segmentsInRect(int layer, const QRectF &rect) const
+{
+    QVector<int> segments;
+    if (layer < 0 || layer >= m_grids.count())
+        return segments;
+
+    const Grid &grid = m_grids.at(layer);
+    const QRect cells = cellsOf(grid, rect.left(), rect.top(), rect.right(), rect.bottom());
+    for (int y = cells.top(); y <= cells.bottom(); ++y) {
+        for (int x = cells.left(); x <= cells.right(); ++x) {
+            const int cell = grid.firstCell + y * grid.columns + x;
+            for (int i = m_cellStarts.at(cell); i < m_cellStarts.at(cell + 1); ++i) {
+                const int segment = m_cellSegments.at(i);
+                if (intersects(rect, m_points.at(m_indices.at(2 * segment)), m_points.at(m_indices.at(2 * segment + 1))))
+                    segments += segment;
+            }
+        }
+    }
+
+    // a segment is listed in each cell that it overlaps
+    std::sort(segments.begin(), segments.end());
+    segments.erase(std::unique(segments.begin(), segments.end()), segments.end());
+    return segments;
+}
+
+int GcodeSpatialGrid::layerOf(int segment) const
+{
+    if (segment < 0 || segment >= m_indices.count() / 2)
+        return -1;
+
+    const auto it = std::upper_bound(m_layers.cbegin(), m_layers.cend(), 2 * segment,
+                                     [](int index, const GcodeLayer &layer) { return index < layer.index; });
+    return int(it - m_layers.cbegin()) - 1;
+}
+
+// the number of the line of a segment, or -1
+int GcodeSpatialGrid::lineOf(int segment) const
+{
+    return m_lineMap.lineOf(segment);
+}
+
+// the first segment of a line, or of the next line with segments, or -1
+int GcodeSpatialGrid::segmentAt(int line) const
+{
+    const int segment = m_lineMap.segmentAt(line);
+    return segment < m_lineMap.count() ? segment : -1;
+}
+
+GcodeSpatialIndex::GcodeSpatialIndex(QObject *parent)
+    : QObject(parent)
+{
+}
+
+int GcodeSpatialIndex::nearestSegment(const QVector3D &point, float maxDistance) const
+{
+    return m_grid.nearestSegment(point, maxDistance);
+}
+
+QVariantList GcodeSpatialIndex::segmentsInRect(int layer, const QRectF &rect) const
+{
+    QVariantList segments;
+    for (int segment : m_grid.segmentsInRect(layer, rect))
+        segments += segment;
+    return segments;
+}
+
+int GcodeSpatialIndex::layerOf(int segment) const
+{
+    return m_grid.layerOf(segment);
+}
+
+int GcodeSpatialIndex::lineOf(int segment) const
+{
+    return m_grid.lineOf(segment);
+}
+
+int GcodeSpatialIndex::segmentAt(int line) const
+{
+    return m_grid.segmentAt(line);
+}
+
+void GcodeSpatialIndex::update(const GcodeSpatialGrid &grid)
+{
+    m_grid = grid;
+    emit changed();
+}
@@ -0,0 +1,111 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#ifndef GCODESPATIALINDEX_H
+#define GCODESPATIALINDEX_H
+
+#include <QtCore/qobject.h>
+#include <QtCore/qrect.h>
+#include <QtCore/qvariant.h>
+#include <QtCore/qvector.h>
+#include <QtGui/qvector3d.h>
+
+#include "gcodeparser.h"
+
+/*
+ * Finds the segments of a toolpath near a point, or within a rectangle of a
+ * layer from above, without scanning all segments, e.g. to identify the move
+ * under the mouse.
+ *
+ * Each layer has a uniform grid over the bounds of its segments from above,
+ * sized for a few segments per cell. The cells list the segments whose bounds
+ * overlap them, in one array for all layers. The nearest segment is searched
+ * in the layers nearest to the point first, in the order of their heights.
+ * Segments are identified by their index in the parsed toolpath, before any
+ * simplification, and are mapped to and from the numbers (from 0) of the
+ * lines they were parsed from, e.g. to highlight the line of a picked
+ * segment in an editor, and vice versa.
+ */
+class GcodeSpatialGrid
+{
+public:
+    GcodeSpatialGrid() = default;
+    GcodeSpatialGrid(const GcodeParser &parser, int tool);
+
+    bool isEmpty() const { return m_grids.isEmpty(); }
+
+    int nearestSegment(const QVector3D &point, float maxDistance) const;
+    QVector<int> segmentsInRect(int layer, const QRectF &rect) const;
+    int layerOf(int segment) const;
+    int lineOf(int segment) const;
+    int segmentAt(int line) const;
+
+private:
+    struct Grid
+    {
+        float z;
+        float left;
+        float top;
+        float cellSize;
+        int columns;
+        int rows;
+        int firstCell;
+    };
+
+    void build(const QVector<GcodeSegment> &segments, int first, int last, int tool, float z);
+    QRect cellsOf(const Grid &grid, float left, float top, float right, float bottom) const;
+
+    QVector<Grid> m_grids;
+    QVector<int> m_layersByZ;
+    QVector<int> m_cellStarts;
+    QVector<int> m_cellSegments;
+
+    QVector<GcodeLayer> m_layers;
+    QVector<QVector3D> m_points;
+    QVector<quint32> m_indices;
+    GcodeLineMap m_lineMap;
+};
+
+// the spatial index of a geometry, which is set once all layers are loaded
+class GcodeSpatialIndex : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit GcodeSpatialIndex(QObject *parent = nullptr);
+
+    Q_INVOKABLE int nearestSegment(const QVector3D &point, float maxDistance) const;
+    Q_INVOKABLE QVariantList segmentsInRect(int layer, const QRectF &rect) const;
+    Q_INVOKABLE int layerOf(int segment) const;
+    Q_INVOKABLE int lineOf(int segment) const;
+    Q_INVOKABLE int segmentAt(int line) const;
+
+    void update(const GcodeSpatialGrid &grid);
+
+signals:
+    void changed();
+
+private:
+    GcodeSpatialGrid m_grid;
+};
+
+#endif // GCODESPATIALINDEX_H
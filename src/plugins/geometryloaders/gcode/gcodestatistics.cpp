@@ -0,0 +1,98 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#include "gcodestatistics.h"
+
+#include <QtCore/qmath.h>
+
+GcodeStatistics::GcodeStatistics(double filamentDiameter, QObject *parent)
+    : QObject(parent),
+      m_filamentDiameter(filamentDiameter)
+{
+}
+
+double GcodeStatistics::printTime() const
+{
+    return m_totals.printTime;
+}
+
+double GcodeStatistics::travelDistance() const
+{
+    return m_totals.travelDistance;
+}
+
+double GcodeStatistics::extrusionDistance() const
+{
+    return m_totals.extrusionDistance;
+}
+
+QVariantList GcodeStatistics::extrudedLength() const
+{
+    QVariantList lengths;
+    for (double length : m_totals.extrusion)
+        lengths += length;
+    return lengths;
+}
+
+// the volume of the extruded filament, or of the extruded bioink for a
+// syringe with the diameter of the piston
+QVariantList GcodeStatistics::extrudedVolume() const
+{
+    const double area = M_PI * m_filamentDiameter * m_filamentDiameter / 4;
+    QVariantList volumes;
+    for (double length : m_totals.extrusion)
+        volumes += length * area;
+    return volumes;
+}
+
+double GcodeStatistics::filamentDiameter() const
+{
+    return m_filamentDiameter;
+}
+
+QVector3D GcodeStatistics::minimum() const
+{
+    return m_minimum;
+}
+
+QVector3D GcodeStatistics::maximum() const
+{
+    return m_maximum;
+}
+
+QVariantList GcodeStatistics::layerHeights() const
+{
+    QVariantList heights;
+    for (float height : m_layerHeights)
+        heights += height;
+    return heights;
+}
+
+void GcodeStatistics::update(const GcodeTotals &totals, const QVector<float> &layerHeights,
+                             const QVector3D &minimum, const QVector3D &maximum)
+{
+    m_totals = totals;
+    m_layerHeights = layerHeights;
+    m_minimum = minimum;
+    m_maximum = maximum;
+    emit changed();
+}
@@ -0,0 +1,73 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#ifndef GCODESTATISTICS_H
+#define GCODESTATISTICS_H
+
+#include <QtCore/qobject.h>
+#include <QtCore/qvariant.h>
+#include <QtGui/qvector3d.h>
+
+#include "gcodeparser.h"
+
+// the statistics of a toolpath, collected while parsing it
+class GcodeStatistics : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(double printTime READ printTime NOTIFY changed FINAL)
+    Q_PROPERTY(double travelDistance READ travelDistance NOTIFY changed FINAL)
+    Q_PROPERTY(double extrusionDistance READ extrusionDistance NOTIFY changed FINAL)
+    Q_PROPERTY(QVariantList extrudedLength READ extrudedLength NOTIFY changed FINAL)
+    Q_PROPERTY(QVariantList extrudedVolume READ extrudedVolume NOTIFY changed FINAL)
+    Q_PROPERTY(double filamentDiameter READ filamentDiameter CONSTANT FINAL)
+    Q_PROPERTY(QVector3D minimum READ minimum NOTIFY changed FINAL)
+    Q_PROPERTY(QVector3D maximum READ maximum NOTIFY changed FINAL)
+    Q_PROPERTY(QVariantList layerHeights READ layerHeights NOTIFY changed FINAL)
+
+public:
+    explicit GcodeStatistics(double filamentDiameter, QObject *parent = nullptr);
+
+    double printTime() const;
+    double travelDistance() const;
+    double extrusionDistance() const;
+    QVariantList extrudedLength() const;
+    QVariantList extrudedVolume() const;
+    double filamentDiameter() const;
+    QVector3D minimum() const;
+    QVector3D maximum() const;
+    QVariantList layerHeights() const;
+
+    void update(const GcodeTotals &totals, const QVector<float> &layerHeights,
+                const QVector3D &minimum, const QVector3D &maximum);
+
+signals:
+    void changed();
+
+private:
+    GcodeTotals m_totals;
+    double m_filamentDiameter = 0;
+    QVector<float> m_layerHeights;
+    QVector3D m_minimum;
+    QVector3D m_maximum;
+};
+
+#endif // GCODESTATISTICS_H
@@ -0,0 +1,111 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#include "gcodethumbnailer.h"
+
+#include <QtConcurrent/qtconcurrentmap.h>
+#include <QtGui/qpainter.h>
+
+struct GcodeLayerImage
+{
+    int first;
+    int last;
+    QImage image;
+};
+
+QImage GcodeThumbnailer::render(const QSize &size, const QVector<QVector3D> &points, const QVector<quint32> &indices)
+{
+    return render(size, bounds(points), points, indices, 0, indices.count());
+}
+
+QVector<QImage> GcodeThumbnailer::renderLayers(const QSize &size, const QVector<GcodeLayer> &layers,
+                                               const QVector<QVector3D> &points, const QVector<quint32> &indices)
+{
+    QVector<GcodeLayerImage> images;
+    images.reserve(layers.count());
+    for (int i = 0; i < layers.count(); ++i) {
+        const int last = i + 1 < layers.count() ? layers.at(i + 1).index : indices.count();
+        images += GcodeLayerImage{layers.at(i).index, last, QImage()};
+    }
+
+    const QRectF rect = bounds(points);
+    QtConcurrent::blockingMap(images, [&](GcodeLayerImage &image) {
+        image.image = render(size, rect, points, indices, image.first, image.last);
+    });
+
+    QVector<QImage> result;
+    result.reserve(images.count());
+    for (const GcodeLayerImage &image : qAsConst(images))
+        result += image.image;
+    return result;
+}
+
+// the bounds of the points from above
+QRectF GcodeThumbnailer::bounds(const QVector<QVector3D> &points)
+{
+    if (points.isEmpty())
+        return QRectF();
+
+    float left = points.first().x(), right = left;
+    float top = points.first().y(), bottom = top;
+    for (const QVector3D &point : points) {
+        left = qMin(left, point.x());
+        right = qMax(right, point.x());
+        top = qMin(top, point.y());
+        bottom = qMax(bottom, point.y());
+    }
+    return QRectF(left, top, right - left, bottom - top);
+}
+
+// draws the segments of a range of indices, flipped so that y points up
+QImage GcodeThumbnailer::render(const QSize &size, const QRectF &bounds, const QVector<QVector3D> &points,
+                                const QVector<quint32> &indices, int first, int last)
+{
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+    if (first >= last || size.isEmpty())
+        return image;
+
+    // a pixel of margin keeps the outermost lines within the image
+    const qreal width = size.width() - 2;
+    const qreal height = size.height() - 2;
+    const qreal scale = qMin(bounds.width() > 0 ? width / bounds.width() : qreal(1),
+                             bounds.height() > 0 ? height / bounds.height() : qreal(1));
+    const qreal dx = 1 + (width - bounds.width() * scale) / 2 - bounds.left() * scale;
+    const qreal dy = 1 + (height - bounds.height() * scale) / 2 + bounds.bottom() * scale;
+
+    QVector<QLineF> lines;
+    lines.reserve((last - first) / 2);
+    for (int i = first; i < last; i += 2) {
+        const QVector3D &from = points.at(indices.at(i));
+        const QVector3D &to = points.at(indices.at(i + 1));
+        lines += QLineF(dx + from.x() * scale, dy - from.y() * scale, dx + to.x() * scale, dy - to.y() * scale);
+    }
+
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::Antialiasing);
+    QPen pen(Qt::black, 1);
+    pen.setCosmetic(true);
+    painter.setPen(pen);
+    painter.drawLines(lines);
+    return image;
+}
@@ -0,0 +1,55 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#ifndef GCODETHUMBNAILER_H
+#define GCODETHUMBNAILER_H
+
+#include <QtCore/qrect.h>
+#include <QtCore/qsize.h>
+#include <QtCore/qvector.h>
+#include <QtGui/qimage.h>
+#include <QtGui/qvector3d.h>
+
+#include "gcodeparser.h"
+
+/*
+ * Draws the extrusion paths of a toolpath from above into small antialiased
+ * images, without a GPU, e.g. for layer previews or job thumbnails.
+ *
+ * The paths are scaled uniformly to fit the images, so that the images of
+ * the layers line up. The layers are drawn in parallel with the raster paint
+ * engine, which works in any thread and without a display.
+ */
+class GcodeThumbnailer
+{
+public:
+    static QImage render(const QSize &size, const QVector<QVector3D> &points, const QVector<quint32> &indices);
+    static QVector<QImage> renderLayers(const QSize &size, const QVector<GcodeLayer> &layers,
+                                        const QVector<QVector3D> &points, const QVector<quint32> &indices);
+
+private:
+    static QRectF bounds(const QVector<QVector3D> &points);
+    static QImage render(const QSize &size, const QRectF &bounds, const QVector<QVector3D> &points,
+                         const QVector<quint32> &indices, int first, int last);
+};
+
+#endif // GCODETHUMBNAILER_H
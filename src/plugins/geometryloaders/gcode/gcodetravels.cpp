@@ -0,0 +1,88 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+
+#include "gcodetravels.h"
+
+#include <Qt3DRender/qbuffer.h>
+
+GcodeTravels::GcodeTravels(Qt3DCore::QNode *parent)
+    : QObject(parent)
+{
+}
+
+// the geometry is a child of the geometry of the toolpath
+Qt3DRender::QGeometry *GcodeTravels::geometry()
+{
+    if (!m_geometry) {
+        m_geometry = new Qt3DRender::QGeometry(qobject_cast<Qt3DCore::QNode *>(parent()));
+        m_attribute = new Qt3DRender::QAttribute(m_geometry);
+        m_attribute->setName(Qt3DRender::QAttribute::defaultPositionAttributeName());
+        m_attribute->setVertexBaseType(Qt3DRender::QAttribute::Float);
+        m_attribute->setVertexSize(3);
+        m_attribute->setByteStride(sizeof(QVector3D));
+        m_attribute->setBuffer(new Qt3DRender::QBuffer(m_geometry));
+        m_geometry->addAttribute(m_attribute);
+        m_geometry->setProperty("layerRanges", m_layerRanges);
+        updateGeometry(0);
+    }
+    return m_geometry;
+}
+
+QVariantList GcodeTravels::layerRanges() const
+{
+    return m_layerRanges;
+}
+
+// replaces the vertices and the layers after the given ones
+void GcodeTravels::append(int offset, int firstLayer, const QVector<QVector3D> &vertices,
+                          const QVariantList &layerRanges)
+{
+    m_vertices.resize(offset);
+    m_vertices += vertices;
+    m_layerRanges = m_layerRanges.mid(0, firstLayer) + layerRanges;
+    if (m_geometry) {
+        m_geometry->setProperty("layerRanges", m_layerRanges);
+        updateGeometry(offset);
+    }
+    emit changed();
+}
+
+// writes the vertices from the first one on in place while they fit in the
+// buffer, otherwise all of them, with room for more when appending
+void GcodeTravels::updateGeometry(int first)
+{
+    Qt3DRender::QBuffer *buffer = m_attribute->buffer();
+    const char *data = reinterpret_cast<const char *>(m_vertices.constData());
+    const int size = m_vertices.count() * sizeof(QVector3D);
+    const int offset = first * sizeof(QVector3D);
+    if (size <= buffer->data().size()) {
+        if (size > offset)
+            buffer->updateData(offset, QByteArray(data + offset, size - offset));
+    } else {
+        QByteArray bytes(data, size);
+        if (first > 0)
+            bytes.resize(size + size / 2);
+        buffer->setData(bytes);
+    }
+    m_attribute->setCount(m_vertices.count());
+}
@@ -0,0 +1,64 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#ifndef GCODETRAVELS_H
+#define GCODETRAVELS_H
+
+#include <QtCore/qobject.h>
+#include <QtCore/qvariant.h>
+#include <QtCore/qvector.h>
+#include <QtGui/qvector3d.h>
+
+#include <Qt3DCore/qnode.h>
+#include <Qt3DRender/qattribute.h>
+#include <Qt3DRender/qgeometry.h>
+
+// the moves without extrusion of a toolpath, as pairs of vertices, which are
+// built into a geometry of lines the first time it is read, and sorted by
+// layer like the toolpath
+class GcodeTravels : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(Qt3DRender::QGeometry *geometry READ geometry NOTIFY changed FINAL)
+    Q_PROPERTY(QVariantList layerRanges READ layerRanges NOTIFY changed FINAL)
+
+public:
+    explicit GcodeTravels(Qt3DCore::QNode *parent = nullptr);
+
+    Qt3DRender::QGeometry *geometry();
+    QVariantList layerRanges() const;
+
+    void append(int offset, int firstLayer, const QVector<QVector3D> &vertices, const QVariantList &layerRanges);
+
+signals:
+    void changed();
+
+private:
+    void updateGeometry(int first);
+
+    QVector<QVector3D> m_vertices;
+    QVariantList m_layerRanges;
+    Qt3DRender::QGeometry *m_geometry = nullptr;
+    Qt3DRender::QAttribute *m_attribute = nullptr;
+};
+
+#endif // GCODETRAVELS_H
@@ -0,0 +1,122 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#ifndef VERTEXQUANTIZER_H
+#define VERTEXQUANTIZER_H
+
+#include <QtCore/qglobal.h>
+#include <QtCore/qstring.h>
+#include <QtGui/qmatrix4x4.h>
+#include <QtGui/qvector2d.h>
+#include <QtGui/qvector3d.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+/*
+ * Compact vertex formats:
+ *
+ * - Positions are stored as unsigned 16-bit normalized integers relative to
+ *   the bounding box of the geometry. The transform() maps the normalized
+ *   [0, 1] coordinates back to model space, and can be used as the model
+ *   matrix of the entity.
+ *
+ * - Unit vectors (normals) are octahedral-encoded into two signed 16-bit
+ *   normalized integers, which shaders decode like octahedralDecode() does.
+ */
+class VertexQuantizer
+{
+public:
+    VertexQuantizer(const QVector3D &min, const QVector3D &max)
+        : m_min(min)
+    {
+        for (int axis = 0; axis < 3; ++axis) {
+            const float extent = max[axis] - min[axis];
+            m_extent[axis] = extent > 0 ? extent : 1;
+        }
+    }
+
+    template <typename Iterator>
+    static VertexQuantizer fromPoints(Iterator begin, Iterator end)
+    {
+        QVector3D min(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+        QVector3D max(std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest());
+        for (Iterator it = begin; it != end; ++it) {
+            for (int axis = 0; axis < 3; ++axis) {
+                min[axis] = std::min(min[axis], (*it)[axis]);
+                max[axis] = std::max(max[axis], (*it)[axis]);
+            }
+        }
+        return begin != end ? VertexQuantizer(min, max) : VertexQuantizer(QVector3D(), QVector3D());
+    }
+
+    QMatrix4x4 transform() const
+    {
+        QMatrix4x4 matrix;
+        matrix.translate(m_min);
+        matrix.scale(m_extent);
+        return matrix;
+    }
+
+    // writes 4 components for 8-byte aligned vertices, the last one is zero
+    void quantizePosition(const QVector3D &position, quint16 *data) const
+    {
+        for (int axis = 0; axis < 3; ++axis) {
+            const float value = (position[axis] - m_min[axis]) / m_extent[axis];
+            data[axis] = static_cast<quint16>(std::lround(qBound(0.0f, value, 1.0f) * 65535.0f));
+        }
+        data[3] = 0;
+    }
+
+    static void octahedralEncode(const QVector3D &normal, qint16 *data)
+    {
+        const float sum = std::abs(normal.x()) + std::abs(normal.y()) + std::abs(normal.z());
+        QVector2D encoded = sum > 0 ? QVector2D(normal.x(), normal.y()) / sum : QVector2D();
+        if (normal.z() < 0) {
+            encoded = QVector2D((1.0f - std::abs(encoded.y())) * (encoded.x() >= 0 ? 1.0f : -1.0f),
+                                (1.0f - std::abs(encoded.x())) * (encoded.y() >= 0 ? 1.0f : -1.0f));
+        }
+        data[0] = static_cast<qint16>(std::lround(qBound(-1.0f, encoded.x(), 1.0f) * 32767.0f));
+        data[1] = static_cast<qint16>(std::lround(qBound(-1.0f, encoded.y(), 1.0f) * 32767.0f));
+    }
+
+    static QVector3D octahedralDecode(const qint16 *data)
+    {
+        const float x = std::max(data[0] / 32767.0f, -1.0f);
+        const float y = std::max(data[1] / 32767.0f, -1.0f);
+        QVector3D normal(x, y, 1.0f - std::abs(x) - std::abs(y));
+        if (normal.z() < 0) {
+            normal.setX((1.0f - std::abs(y)) * (x >= 0 ? 1.0f : -1.0f));
+            normal.setY((1.0f - std::abs(x)) * (y >= 0 ? 1.0f : -1.0f));
+        }
+        return normal.normalized();
+    }
+
+    static QString octahedralNormalAttributeName() { return QStringLiteral("vertexOctahedralNormal"); }
+
+private:
+    QVector3D m_min;
+    QVector3D m_extent;
+};
+
+#endif // VERTEXQUANTIZER_H
@@ -0,0 +1,7 @@
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    gcodecache \
+    gcodelinemap \
+    gcodeparser \
+    gcodesimplifier
@@ -0,0 +1,17 @@
+CONFIG += testcase
+TARGET = tst_gcodecache
+QT += testlib concurrent gui
+
+GCODE = $$PWD/../../../src/plugins/geometryloaders/gcode
+INCLUDEPATH += $$GCODE
+
+HEADERS += \
+    $$GCODE/gcodecache.h \
+    $$GCODE/gcodelinemap.h \
+    $$GCODE/gcodeparser.h
+
+SOURCES += \
+    $$GCODE/gcodecache.cpp \
+    $$GCODE/gcodelinemap.cpp \
+    $$GCODE/gcodeparser.cpp \
+    tst_gcodecache.cpp
@@ -0,0 +1,218 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#include <QtTest/qtest.h>
+#include <QtCore/qfile.h>
+#include <QtCore/qscopedpointer.h>
+#include <QtCore/qtemporarydir.h>
+
+#include "gcodecache.h"
+#include "gcodeparser.h"
+
+// layers of squares, with a travel to the start of each square
+static QByteArray squares(int layers, int squaresPerLayer)
+{
+    QByteArray gcode = "G90\nM83\nG1 F1200\n";
+    for (int layer = 0; layer < layers; ++layer) {
+        const QByteArray z = QByteArray::number(0.2 * (layer + 1), 'f', 2);
+        for (int square = 0; square < squaresPerLayer; ++square) {
+            const QByteArray x0 = QByteArray::number(10 * square);
+            const QByteArray x1 = QByteArray::number(10 * square + 5);
+            gcode += "G0 X" + x0 + " Y0 Z" + z + "\n";
+            gcode += "G1 X" + x1 + " Y0 E0.5\n";
+            gcode += "G1 X" + x1 + " Y5 E0.5\n";
+            gcode += "G1 X" + x0 + " Y5 E0.5 T" + QByteArray::number(square % 2) + "\n";
+            gcode += "G1 X" + x0 + " Y0 E0.5 ; close\n";
+        }
+    }
+    return gcode;
+}
+
+static bool writeFile(const QString &fileName, const QByteArray &data)
+{
+    QFile file(fileName);
+    return file.open(QFile::WriteOnly) && file.write(data) == data.size();
+}
+
+static GcodeParser parse(const QByteArray &gcode, bool travels)
+{
+    GcodeParser parser;
+    parser.setTotalsEnabled(true);
+    parser.setTravelsEnabled(travels);
+    parser.setLineMapEnabled(true);
+    parser.setOrigin(gcode.constData(), 0);
+    parser.parse(gcode.constData(), gcode.constData() + gcode.size());
+    return parser;
+}
+
+static void compare(const GcodeParser &actual, const GcodeParser &expected)
+{
+    QCOMPARE(actual.layers().count(), expected.layers().count());
+    for (int i = 0; i < expected.layers().count(); ++i) {
+        const GcodeLayer &layer = actual.layers().at(i);
+        QCOMPARE(layer.z, expected.layers().at(i).z);
+        QCOMPARE(layer.index, expected.layers().at(i).index);
+        QCOMPARE(layer.travel, expected.layers().at(i).travel);
+        QCOMPARE(layer.offset, expected.layers().at(i).offset);
+        QCOMPARE(layer.line, expected.layers().at(i).line);
+    }
+    QCOMPARE(actual.points(), expected.points());
+    QCOMPARE(actual.indices(), expected.indices());
+    QCOMPARE(actual.travels(), expected.travels());
+    QCOMPARE(actual.segments().count(), expected.segments().count());
+    for (int i = 0; i < expected.segments().count(); ++i) {
+        const GcodeSegment &segment = actual.segments().at(i);
+        QCOMPARE(segment.feedrate, expected.segments().at(i).feedrate);
+        QCOMPARE(segment.extrusion, expected.segments().at(i).extrusion);
+        QCOMPARE(segment.tool, expected.segments().at(i).tool);
+        QCOMPARE(segment.time, expected.segments().at(i).time);
+        QCOMPARE(actual.lineMap().lineOf(i), expected.lineMap().lineOf(i));
+    }
+    QCOMPARE(actual.totals().printTime, expected.totals().printTime);
+    QCOMPARE(actual.totals().travelDistance, expected.totals().travelDistance);
+    QCOMPARE(actual.totals().extrusionDistance, expected.totals().extrusionDistance);
+    QCOMPARE(actual.totals().extrusion, expected.totals().extrusion);
+}
+
+class tst_GcodeCache : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void writeAndRead();
+    void rejectStale();
+    void rejectMissingOutputs();
+    void rejectCorruptLayers_data();
+    void rejectCorruptLayers();
+    void memoryCache();
+
+private:
+    QScopedPointer<QTemporaryDir> m_dir;
+    QString m_fileName;
+    QString m_cacheFileName;
+    QByteArray m_gcode;
+};
+
+void tst_GcodeCache::init()
+{
+    m_dir.reset(new QTemporaryDir);
+    QVERIFY(m_dir->isValid());
+    m_fileName = m_dir->filePath(QStringLiteral("squares.gcode"));
+    m_cacheFileName = GcodeCache::cacheFileName(m_fileName, QString());
+    m_gcode = squares(20, 3);
+    QVERIFY(writeFile(m_fileName, m_gcode));
+}
+
+// a cache file restores the same output as parsing the file
+void tst_GcodeCache::writeAndRead()
+{
+    const GcodeParser parser = parse(m_gcode, true);
+    QVERIFY(GcodeCache::write(m_cacheFileName, m_fileName, parser));
+
+    GcodeParser restored;
+    restored.setTravelsEnabled(true);
+    QVERIFY(GcodeCache::read(m_cacheFileName, m_fileName, &restored));
+    QVERIFY(restored.travelsEnabled());
+    QVERIFY(restored.lineMapEnabled());
+    compare(restored, parser);
+}
+
+void tst_GcodeCache::rejectStale()
+{
+    QVERIFY(GcodeCache::write(m_cacheFileName, m_fileName, parse(m_gcode, false)));
+    QVERIFY(writeFile(m_fileName, m_gcode + "G1 X0 Y0 E1\n"));
+
+    GcodeParser restored;
+    QVERIFY(!GcodeCache::read(m_cacheFileName, m_fileName, &restored));
+    QVERIFY(restored.points().isEmpty());
+}
+
+// a cache without travels cannot be read by a parser that wants them
+void tst_GcodeCache::rejectMissingOutputs()
+{
+    QVERIFY(GcodeCache::write(m_cacheFileName, m_fileName, parse(m_gcode, false)));
+
+    GcodeParser restored;
+    restored.setTravelsEnabled(true);
+    QVERIFY(!GcodeCache::read(m_cacheFileName, m_fileName, &restored));
+    restored.setTravelsEnabled(false);
+    QVERIFY(GcodeCache::read(m_cacheFileName, m_fileName, &restored));
+}
+
+void tst_GcodeCache::rejectCorruptLayers_data()
+{
+    QTest::addColumn<int>("layer");
+    QTest::addColumn<int>("index");
+    QTest::addColumn<int>("travel");
+
+    QTest::newRow("odd index") << 5 << 1 << 0;
+    QTest::newRow("decreasing index") << 5 << -2 << 0;
+    QTest::newRow("index past the end") << 19 << 1000000 << 0;
+    QTest::newRow("decreasing travel") << 5 << 0 << -2;
+    QTest::newRow("travel past the end") << 19 << 0 << 1000000;
+}
+
+// the layers of a cache file that would slice the toolpath out of range
+void tst_GcodeCache::rejectCorruptLayers()
+{
+    QFETCH(int, layer);
+    QFETCH(int, index);
+    QFETCH(int, travel);
+
+    const GcodeParser parser = parse(m_gcode, true);
+    QVector<GcodeLayer> layers = parser.layers();
+    layers[layer].index = index >= 0 ? layers.at(layer).index + index : layers.at(layer - 1).index + index;
+    layers[layer].travel = travel >= 0 ? layers.at(layer).travel + travel : layers.at(layer - 1).travel + travel;
+
+    GcodeParser corrupt;
+    corrupt.setTravelsEnabled(true);
+    corrupt.setLineMapEnabled(true);
+    corrupt.restore(layers, parser.points(), parser.indices(), parser.segments(), parser.travels(),
+                    parser.lineMap(), parser.totals());
+    QVERIFY(GcodeCache::write(m_cacheFileName, m_fileName, corrupt));
+
+    GcodeParser restored;
+    QVERIFY(!GcodeCache::read(m_cacheFileName, m_fileName, &restored));
+}
+
+// an inserted file is found in memory, and in its cache file once it has
+// been written
+void tst_GcodeCache::memoryCache()
+{
+    const GcodeParser parser = parse(m_gcode, true);
+    GcodeCache::insert(m_fileName, m_cacheFileName, parser);
+    QVERIFY(QFile::exists(m_cacheFileName));
+
+    GcodeParser found;
+    found.setTravelsEnabled(true);
+    QVERIFY(GcodeCache::find(m_fileName, QString(), &found));
+    compare(found, parser);
+
+    GcodeParser changed;
+    QVERIFY(writeFile(m_fileName, m_gcode + "G1 X0 Y0 E1\n"));
+    QVERIFY(!GcodeCache::find(m_fileName, m_cacheFileName, &changed));
+}
+
+QTEST_APPLESS_MAIN(tst_GcodeCache)
+
+#include "tst_gcodecache.moc"
@@ -0,0 +1,13 @@
+CONFIG += testcase
+TARGET = tst_gcodelinemap
+QT += testlib
+
+GCODE = $$PWD/../../../src/plugins/geometryloaders/gcode
+INCLUDEPATH += $$GCODE
+
+HEADERS += \
+    $$GCODE/gcodelinemap.h
+
+SOURCES += \
+    $$GCODE/gcodelinemap.cpp \
+    tst_gcodelinemap.cpp
@@ -0,0 +1,129 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#include <QtTest/qtest.h>
+
+#include "gcodelinemap.h"
+
+// the line of each segment: runs of segments on a line, lines without
+// segments, and gaps of more lines than fit in a byte
+static QVector<int> lines(int count)
+{
+    QVector<int> lines;
+    int line = 3;
+    for (int segment = 0; segment < count; ++segment) {
+        if (segment % 7 == 0)
+            line += 1;
+        else if (segment % 11 == 0)
+            line += 2;
+        else if (segment % 101 == 0)
+            line += 300;
+        lines += line;
+    }
+    return lines;
+}
+
+static GcodeLineMap toLineMap(const QVector<int> &lines)
+{
+    GcodeLineMap lineMap;
+    for (int line : lines)
+        lineMap.append(line);
+    return lineMap;
+}
+
+class tst_GcodeLineMap : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void lineOf();
+    void segmentAt();
+    void appendMap();
+    void restore();
+};
+
+void tst_GcodeLineMap::lineOf()
+{
+    const QVector<int> expected = lines(1000);
+    const GcodeLineMap lineMap = toLineMap(expected);
+    QCOMPARE(lineMap.count(), expected.count());
+    for (int segment = 0; segment < expected.count(); ++segment)
+        QCOMPARE(lineMap.lineOf(segment), expected.at(segment));
+    QCOMPARE(lineMap.lineOf(-1), -1);
+    QCOMPARE(lineMap.lineOf(expected.count()), -1);
+    QCOMPARE(GcodeLineMap().lineOf(0), -1);
+}
+
+// the first segment of a line, or of the next line with segments
+void tst_GcodeLineMap::segmentAt()
+{
+    const QVector<int> expected = lines(1000);
+    const GcodeLineMap lineMap = toLineMap(expected);
+    for (int line = 0; line <= expected.last() + 1; ++line) {
+        const int segment = int(std::lower_bound(expected.cbegin(), expected.cend(), line) - expected.cbegin());
+        QCOMPARE(lineMap.segmentAt(line), segment);
+    }
+    QCOMPARE(GcodeLineMap().segmentAt(0), 0);
+}
+
+// appending the map of a chunk is the same as appending its lines
+void tst_GcodeLineMap::appendMap()
+{
+    const QVector<int> first = lines(500);
+    const QVector<int> second = lines(700);
+    const int offset = first.last() + 5;
+
+    GcodeLineMap lineMap = toLineMap(first);
+    lineMap.append(toLineMap(second), offset);
+
+    QVector<int> expected = first;
+    for (int line : second)
+        expected += offset + line;
+    QCOMPARE(lineMap.count(), expected.count());
+    for (int segment = 0; segment < expected.count(); ++segment)
+        QCOMPARE(lineMap.lineOf(segment), expected.at(segment));
+}
+
+// the arrays of a map make the same map again, and broken arrays are invalid
+void tst_GcodeLineMap::restore()
+{
+    const QVector<int> expected = lines(1000);
+    const GcodeLineMap lineMap = toLineMap(expected);
+    const GcodeLineMap restored(lineMap.checkpoints(), lineMap.deltas());
+    QVERIFY(restored.isValid());
+    for (int segment = 0; segment < expected.count(); ++segment)
+        QCOMPARE(restored.lineOf(segment), expected.at(segment));
+
+    // appending continues from the last line of the restored map
+    GcodeLineMap appended = restored;
+    appended.append(expected.last() + 1);
+    QCOMPARE(appended.lineOf(expected.count()), expected.last() + 1);
+
+    QVERIFY(!GcodeLineMap(lineMap.checkpoints(), lineMap.deltas().mid(0, 1)).isValid());
+    QVERIFY(!GcodeLineMap(lineMap.checkpoints().mid(1), lineMap.deltas()).isValid());
+    QVERIFY(!GcodeLineMap(QVector<GcodeLineCheckpoint>(), lineMap.deltas()).isValid());
+    QVERIFY(GcodeLineMap().isValid());
+}
+
+QTEST_APPLESS_MAIN(tst_GcodeLineMap)
+
+#include "tst_gcodelinemap.moc"
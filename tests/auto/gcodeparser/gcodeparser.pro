@@ -0,0 +1,24 @@
+CONFIG += testcase
+TARGET = tst_gcodeparser
+QT += testlib concurrent gui
+
+GCODE = $$PWD/../../../src/plugins/geometryloaders/gcode
+INCLUDEPATH += $$GCODE
+
+HEADERS += \
+    $$GCODE/gcodegzipdevice.h \
+    $$GCODE/gcodelinemap.h \
+    $$GCODE/gcodeparser.h
+
+SOURCES += \
+    $$GCODE/gcodegzipdevice.cpp \
+    $$GCODE/gcodelinemap.cpp \
+    $$GCODE/gcodeparser.cpp \
+    tst_gcodeparser.cpp
+
+QT_FOR_CONFIG += core-private
+qtConfig(system-zlib) {
+    QMAKE_USE_PRIVATE += zlib
+} else {
+    QT_PRIVATE += zlib-private
+}
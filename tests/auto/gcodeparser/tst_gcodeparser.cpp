@@ -0,0 +1,443 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#include <QtTest/qtest.h>
+#include <QtCore/qalgorithms.h>
+#include <QtCore/qbuffer.h>
+
+#include <cmath>
+#include <cstring>
+
+#include <zlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "gcodegzipdevice.h"
+#include "gcodeparser.h"
+
+// layers of squares, with a travel to the start of each square
+static QByteArray squares(int layers, int squaresPerLayer)
+{
+    QByteArray gcode = "G90\nM83\nG1 F1200\n";
+    for (int layer = 0; layer < layers; ++layer) {
+        const QByteArray z = QByteArray::number(0.2 * (layer + 1), 'f', 2);
+        for (int square = 0; square < squaresPerLayer; ++square) {
+            const QByteArray x0 = QByteArray::number(10 * square);
+            const QByteArray x1 = QByteArray::number(10 * square + 5);
+            gcode += "G0 X" + x0 + " Y0 Z" + z + "\n";
+            gcode += "G1 X" + x1 + " Y0 E0.5\n";
+            gcode += "G1 X" + x1 + " Y5 E0.5\n";
+            gcode += "G1 X" + x0 + " Y5 E0.5\n";
+            gcode += "G1 X" + x0 + " Y0 E0.5 ; close\n";
+        }
+    }
+    return gcode;
+}
+
+// a toolpath that switches between absolute and relative positioning and
+// extrusion, tools and feedrates, so that chunks start in any state
+static QByteArray mixed(int moves)
+{
+    QByteArray gcode = "G90\nM83\nG1 F1200\n";
+    float e = 0;
+    bool absoluteExtrusion = false;
+    for (int i = 0; i < moves; ++i) {
+        const QByteArray x = QByteArray::number(i * 37 % 1000 / 10.0);
+        const QByteArray y = QByteArray::number(i * 53 % 1000 / 10.0);
+        switch (i % 97) {
+        case 0:
+            gcode += "G1 Z" + QByteArray::number(0.2 * (i / 97 + 1), 'f', 2) + "\n";
+            break;
+        case 13:
+            gcode += "G91\n";
+            break;
+        case 19:
+            gcode += "G90\n";
+            break;
+        case 29:
+            gcode += "M82\nG92 E0\n";
+            absoluteExtrusion = true;
+            e = 0;
+            break;
+        case 43:
+            gcode += "M83\n";
+            absoluteExtrusion = false;
+            break;
+        case 53:
+            gcode += "T" + QByteArray::number(i / 97 % 3) + "\n";
+            break;
+        case 61:
+            gcode += "G0 X" + x + " Y" + y + "\n";
+            break;
+        case 71:
+            gcode += "G1 F" + QByteArray::number(600 + i % 2400) + " ; feedrate\n";
+            break;
+        default:
+            e += 0.1f;
+            gcode += "G1 X" + x + " Y" + y + " E"
+                    + (absoluteExtrusion ? QByteArray::number(e, 'f', 3) : QByteArray("0.1")) + "\r\n";
+            break;
+        }
+    }
+    return gcode;
+}
+
+static QByteArray gzip(const QByteArray &data)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return QByteArray();
+
+    QByteArray compressed(int(deflateBound(&stream, uLong(data.size()))), Qt::Uninitialized);
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.constData()));
+    stream.avail_in = uInt(data.size());
+    stream.next_out = reinterpret_cast<Bytef *>(compressed.data());
+    stream.avail_out = uInt(compressed.size());
+    const int result = deflate(&stream, Z_FINISH);
+    compressed.resize(int(stream.total_out));
+    deflateEnd(&stream);
+    return result == Z_STREAM_END ? compressed : QByteArray();
+}
+
+static void compareToolpaths(const GcodeParser &actual, const GcodeParser &expected)
+{
+    QCOMPARE(actual.layers().count(), expected.layers().count());
+    for (int i = 0; i < expected.layers().count(); ++i) {
+        const GcodeLayer &layer = actual.layers().at(i);
+        QCOMPARE(layer.z, expected.layers().at(i).z);
+        QCOMPARE(layer.index, expected.layers().at(i).index);
+        QCOMPARE(layer.travel, expected.layers().at(i).travel);
+        QCOMPARE(layer.offset, expected.layers().at(i).offset);
+        QCOMPARE(layer.line, expected.layers().at(i).line);
+        QCOMPARE(layer.state.tool, expected.layers().at(i).state.tool);
+    }
+    QCOMPARE(actual.points(), expected.points());
+    QCOMPARE(actual.indices(), expected.indices());
+    QCOMPARE(actual.travels(), expected.travels());
+    QCOMPARE(actual.segments().count(), expected.segments().count());
+    for (int i = 0; i < expected.segments().count(); ++i) {
+        const GcodeSegment &segment = actual.segments().at(i);
+        QCOMPARE(segment.feedrate, expected.segments().at(i).feedrate);
+        QCOMPARE(segment.extrusion, expected.segments().at(i).extrusion);
+        QCOMPARE(segment.tool, expected.segments().at(i).tool);
+        QVERIFY(qAbs(segment.time - expected.segments().at(i).time) <= 1e-4f * qMax(1.0f, segment.time));
+        QCOMPARE(actual.lineMap().lineOf(i), expected.lineMap().lineOf(i));
+    }
+    QVERIFY(qAbs(actual.totals().printTime - expected.totals().printTime) <= 1e-4 * expected.totals().printTime);
+    QVERIFY(qAbs(actual.totals().travelDistance - expected.totals().travelDistance)
+            <= 1e-6 * expected.totals().travelDistance);
+    QVERIFY(qAbs(actual.totals().extrusionDistance - expected.totals().extrusionDistance)
+            <= 1e-6 * expected.totals().extrusionDistance);
+}
+
+#ifdef __SSE2__
+// 8 digits, the most significant first
+static quint64 toNumber(const char *digits)
+{
+    quint64 value;
+    memcpy(&value, digits, sizeof(value));
+    value -= Q_UINT64_C(0x3030303030303030);
+    value = (value * 10 + (value >> 8)) & Q_UINT64_C(0x00ff00ff00ff00ff);
+    value = (value * 100 + (value >> 16)) & Q_UINT64_C(0x0000ffff0000ffff);
+    return (value * 10000 + (value >> 32)) & Q_UINT64_C(0xffffffff);
+}
+
+// GcodeParser::readFloat() with the digits and the dot of a word classified
+// 16 bytes at a time, and converted 8 at a time
+static float readFloatSse2(const char *&it, const char *end, bool *ok)
+{
+    static const double powersOf10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+                                         1e10, 1e11, 1e12, 1e13, 1e14, 1e15 };
+
+    const char *p = it;
+    const bool negative = p != end && *p == '-';
+    if (p != end && (*p == '-' || *p == '+'))
+        ++p;
+    if (end - p < 16)
+        return GcodeParser::readFloat(it, end, ok);
+
+    const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    const __m128i digitChars = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)),
+                                             _mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+    const uint digitBits = uint(_mm_movemask_epi8(digitChars));
+    const uint dotBits = uint(_mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8('.'))));
+    // the word ends at the first character that is neither a digit nor the first dot
+    const uint wordBits = digitBits | (dotBits & (0u - dotBits));
+    const int length = int(qCountTrailingZeroBits(~wordBits | 0x10000u));
+    if (length == 16)
+        return GcodeParser::readFloat(it, end, ok);
+
+    const int dot = dotBits & ((1u << length) - 1) ? int(qCountTrailingZeroBits(dotBits)) : length;
+    const int digits = length - (dot < length);
+    *ok = digits > 0;
+    if (!*ok)
+        return 0;
+
+    char buffer[16];
+    memset(buffer, '0', sizeof(buffer));
+    memcpy(buffer + 16 - digits, p, dot);
+    if (dot < length)
+        memcpy(buffer + 16 - digits + dot, p + dot + 1, length - dot - 1);
+    const double mantissa = double(toNumber(buffer) * 100000000 + toNumber(buffer + 8));
+    const double value = mantissa / powersOf10[dot < length ? length - dot - 1 : 0];
+    it = p + length;
+    return float(negative ? -value : value);
+}
+#endif
+
+static GcodeParser parserWithOutputs()
+{
+    GcodeParser parser;
+    parser.setTotalsEnabled(true);
+    parser.setTravelsEnabled(true);
+    parser.setLineMapEnabled(true);
+    return parser;
+}
+
+class tst_GcodeParser : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void seekWithTravels();
+    void printTimeThroughJunctions();
+    void parseConcurrent();
+    void parseCompressed();
+    void readFloat_data();
+    void readFloat();
+    void benchmarkReadFloat_data();
+    void benchmarkReadFloat();
+};
+
+// seeking to an indexed layer gives the same output as skipping the layers
+// before it while parsing
+void tst_GcodeParser::seekWithTravels()
+{
+    const QByteArray gcode = squares(20, 3);
+    const char *begin = gcode.constData();
+    const char *end = begin + gcode.size();
+
+    GcodeParser indexer;
+    indexer.setTravelsEnabled(true);
+    indexer.setOrigin(begin, 0);
+    indexer.parse(begin, end);
+    const QVector<GcodeLayer> index = indexer.layers();
+    QCOMPARE(index.count(), 20);
+
+    GcodeParser skipping;
+    skipping.setTravelsEnabled(true);
+    skipping.setLayerRange(5, 9);
+    skipping.setOrigin(begin, 0);
+    skipping.parse(begin, end);
+
+    GcodeParser seeking;
+    seeking.setTravelsEnabled(true);
+    seeking.setLayerRange(5, 9);
+    const qint64 offset = seeking.seek(index, 5);
+    seeking.setOrigin(begin + offset, offset);
+    seeking.parse(begin + offset, end);
+
+    QCOMPARE(seeking.layers().count(), skipping.layers().count());
+    for (int i = 0; i < skipping.layers().count(); ++i) {
+        QCOMPARE(seeking.layers().at(i).index, skipping.layers().at(i).index);
+        QCOMPARE(seeking.layers().at(i).travel, skipping.layers().at(i).travel);
+        QCOMPARE(seeking.layers().at(i).offset, skipping.layers().at(i).offset);
+    }
+    QCOMPARE(seeking.layers().at(4).travel, 0);
+    QCOMPARE(seeking.travels(), skipping.travels());
+    QCOMPARE(seeking.points(), skipping.points());
+    QCOMPARE(seeking.indices(), skipping.indices());
+}
+
+// a circle of 0.5 mm chords at 50 mm/s keeps its speed through the corners
+void tst_GcodeParser::printTimeThroughJunctions()
+{
+    const int chords = 1280;
+    const double radius = 0.5 * chords / (2 * M_PI);
+    QByteArray gcode = "G90\nM83\nG92 X" + QByteArray::number(radius) + " Y0\nG1 F3000\n";
+    for (int chord = 1; chord <= chords; ++chord) {
+        const double angle = 2 * M_PI * chord / chords;
+        gcode += "G1 X" + QByteArray::number(radius * std::cos(angle), 'f', 4)
+                + " Y" + QByteArray::number(radius * std::sin(angle), 'f', 4) + " E0.02\n";
+    }
+
+    GcodeParser parser;
+    parser.setTotalsEnabled(true);
+    parser.setOrigin(gcode.constData(), 0);
+    parser.parse(gcode.constData(), gcode.constData() + gcode.size());
+
+    // the nominal 12.8 s, and accelerating from and decelerating to a stop
+    const double time = parser.totals().printTime;
+    QVERIFY(time > 12.8);
+    QVERIFY(time < 12.9);
+    QCOMPARE(parser.segments().last().time, float(time));
+}
+
+// parsing chunks concurrently, from the beginning of a file or after a
+// first block, gives the same output as parsing it line by line
+void tst_GcodeParser::parseConcurrent()
+{
+    const QByteArray gcode = mixed(200000);
+    const char *begin = gcode.constData();
+    const char *end = begin + gcode.size();
+
+    GcodeParser serial = parserWithOutputs();
+    serial.setOrigin(begin, 0);
+    serial.parse(begin, end);
+    QVERIFY(serial.layers().count() > 1000);
+
+    GcodeParser concurrent = parserWithOutputs();
+    concurrent.setOrigin(begin, 0);
+    concurrent.parseConcurrent(begin, end);
+    compareToolpaths(concurrent, serial);
+
+    const char *next = begin + gcode.indexOf('\n', gcode.size() / 3) + 1;
+    GcodeParser continued = parserWithOutputs();
+    continued.setOrigin(begin, 0);
+    continued.parse(begin, next);
+    continued.parseConcurrent(next, end);
+    compareToolpaths(continued, serial);
+}
+
+// a gzip compressed file, of more than one member, is inflated while parsing
+void tst_GcodeParser::parseCompressed()
+{
+    const QByteArray gcode = mixed(20000);
+    const int half = gcode.indexOf('\n', gcode.size() / 2) + 1;
+    QByteArray compressed = gzip(gcode.left(half)) + gzip(gcode.mid(half));
+
+    GcodeParser plain = parserWithOutputs();
+    plain.setOrigin(gcode.constData(), 0);
+    plain.parse(gcode.constData(), gcode.constData() + gcode.size());
+
+    QBuffer buffer(&compressed);
+    QVERIFY(buffer.open(QBuffer::ReadOnly));
+    QVERIFY(GcodeGzipDevice::isCompressed(&buffer));
+    GcodeGzipDevice device(&buffer);
+    QVERIFY(device.isOpen());
+    GcodeParser inflated = parserWithOutputs();
+    inflated.parse(&device);
+    compareToolpaths(inflated, plain);
+
+    // a truncated file keeps the lines inflated so far
+    QByteArray truncated = compressed.left(compressed.size() / 4);
+    QBuffer truncatedBuffer(&truncated);
+    QVERIFY(truncatedBuffer.open(QBuffer::ReadOnly));
+    GcodeGzipDevice truncatedDevice(&truncatedBuffer);
+    GcodeParser partial = parserWithOutputs();
+    partial.parse(&truncatedDevice);
+    QVERIFY(!partial.segments().isEmpty());
+    QVERIFY(partial.segments().count() < plain.segments().count());
+}
+
+void tst_GcodeParser::readFloat_data()
+{
+    QTest::addColumn<QByteArray>("word");
+    QTest::addColumn<float>("value");
+    QTest::addColumn<int>("length");
+
+    QTest::newRow("integer") << QByteArray("10") << 10.0f << 2;
+    QTest::newRow("decimal") << QByteArray("123.456") << 123.456f << 7;
+    QTest::newRow("negative") << QByteArray("-0.5") << -0.5f << 4;
+    QTest::newRow("positive") << QByteArray("+.25") << 0.25f << 4;
+    QTest::newRow("trailing dot") << QByteArray("7.") << 7.0f << 2;
+    QTest::newRow("packed") << QByteArray("10Y5") << 10.0f << 2;
+    QTest::newRow("second dot") << QByteArray("1.5.2") << 1.5f << 3;
+    QTest::newRow("long") << QByteArray("12345678901234567890") << 12345678901234567890.0f << 20;
+    QTest::newRow("small") << QByteArray("0.0000012") << 0.0000012f << 9;
+    QTest::newRow("none") << QByteArray("X1") << 0.0f << -1;
+    QTest::newRow("sign only") << QByteArray("-") << 0.0f << -1;
+}
+
+void tst_GcodeParser::readFloat()
+{
+    QFETCH(QByteArray, word);
+    QFETCH(float, value);
+    QFETCH(int, length);
+
+    const char *it = word.constData();
+    bool ok = false;
+    QCOMPARE(GcodeParser::readFloat(it, word.constData() + word.size(), &ok), value);
+    QCOMPARE(ok, length >= 0);
+    if (ok)
+        QCOMPARE(int(it - word.constData()), length);
+}
+
+void tst_GcodeParser::benchmarkReadFloat_data()
+{
+    QTest::addColumn<bool>("sse2");
+
+    QTest::newRow("scalar") << false;
+#ifdef __SSE2__
+    QTest::newRow("sse2") << true;
+#endif
+}
+
+// the numbers of typical moves, which are too short for the SSE2 scan to
+// be faster than the scalar one
+void tst_GcodeParser::benchmarkReadFloat()
+{
+    QFETCH(bool, sse2);
+
+    QByteArray gcode;
+    for (int i = 0; i < 100000; ++i) {
+        gcode += "G1 X" + QByteArray::number(i * 37 % 200000 / 1000.0, 'f', 3)
+                + " Y" + QByteArray::number(i * 53 % 200000 / 1000.0, 'f', 3)
+                + " E" + QByteArray::number(i * 71 % 10000 / 100000.0, 'f', 5) + "\n";
+    }
+    const char *end = gcode.constData() + gcode.size();
+    QVector<const char *> words;
+    for (const char *it = gcode.constData(); it != end; ++it) {
+        if (*it == 'X' || *it == 'Y' || *it == 'E')
+            words += it + 1;
+    }
+
+    double sum = 0;
+    QBENCHMARK {
+        sum = 0;
+        for (const char *word : qAsConst(words)) {
+            const char *it = word;
+            bool ok = false;
+#ifdef __SSE2__
+            sum += sse2 ? readFloatSse2(it, end, &ok) : GcodeParser::readFloat(it, end, &ok);
+#else
+            sum += GcodeParser::readFloat(it, end, &ok);
+#endif
+            sum += it - word;
+        }
+    }
+
+    double expected = 0;
+    for (const char *word : qAsConst(words)) {
+        const char *it = word;
+        bool ok = false;
+        expected += GcodeParser::readFloat(it, end, &ok);
+        expected += it - word;
+    }
+    QCOMPARE(sum, expected);
+}
+
+QTEST_APPLESS_MAIN(tst_GcodeParser)
+
+#include "tst_gcodeparser.moc"
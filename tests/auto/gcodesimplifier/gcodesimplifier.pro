@@ -0,0 +1,17 @@
+CONFIG += testcase
+TARGET = tst_gcodesimplifier
+QT += testlib concurrent gui
+
+GCODE = $$PWD/../../../src/plugins/geometryloaders/gcode
+INCLUDEPATH += $$GCODE
+
+HEADERS += \
+    $$GCODE/gcodelinemap.h \
+    $$GCODE/gcodeparser.h \
+    $$GCODE/gcodesimplifier.h
+
+SOURCES += \
+    $$GCODE/gcodelinemap.cpp \
+    $$GCODE/gcodeparser.cpp \
+    $$GCODE/gcodesimplifier.cpp \
+    tst_gcodesimplifier.cpp
@@ -0,0 +1,185 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 CELLINK AB <info@cellink.com>
+**
+** This file is part of QtCellink.
+**
+** QtCellink is free software: you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License as published
+** by the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** QtCellink is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with QtCellink. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#include <QtTest/qtest.h>
+
+#include <cmath>
+#include <limits>
+
+#include "gcodeparser.h"
+#include "gcodesimplifier.h"
+
+static GcodeParser parse(const QByteArray &gcode)
+{
+    GcodeParser parser;
+    parser.setOrigin(gcode.constData(), 0);
+    parser.parse(gcode.constData(), gcode.constData() + gcode.size());
+    return parser;
+}
+
+struct Toolpath
+{
+    QVector<GcodeLayer> layers;
+    QVector<QVector3D> points;
+    QVector<quint32> indices;
+    QVector<GcodeSegment> segments;
+
+    explicit Toolpath(const GcodeParser &parser)
+        : layers(parser.layers()), points(parser.points()), indices(parser.indices()), segments(parser.segments())
+    {
+    }
+
+    void simplify(float tolerance)
+    {
+        GcodeSimplifier::simplify(tolerance, layers, points, indices, segments);
+    }
+
+    double extrusion() const
+    {
+        double extrusion = 0;
+        for (const GcodeSegment &segment : segments)
+            extrusion += segment.extrusion;
+        return extrusion;
+    }
+};
+
+static float distanceToSegment(const QVector3D &point, const QVector3D &from, const QVector3D &to)
+{
+    const QVector3D direction = to - from;
+    const float t = qBound(0.0f, QVector3D::dotProduct(point - from, direction) / direction.lengthSquared(), 1.0f);
+    return point.distanceToPoint(from + t * direction);
+}
+
+// a path along the x axis, from x = 0 in steps of 1 mm
+static QByteArray line(int steps, float z = 0.2f)
+{
+    QByteArray gcode = "G90\nM83\nG1 F1200\nG0 X0 Y0 Z" + QByteArray::number(z) + "\n";
+    for (int x = 1; x <= steps; ++x)
+        gcode += "G1 X" + QByteArray::number(x) + " E0.1\n";
+    return gcode;
+}
+
+class tst_GcodeSimplifier : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void mergeCollinear();
+    void decimateWithinTolerance();
+    void keepRuns();
+    void keepLayers();
+};
+
+void tst_GcodeSimplifier::mergeCollinear()
+{
+    Toolpath toolpath(parse(line(10)));
+    QCOMPARE(toolpath.segments.count(), 10);
+
+    toolpath.simplify(0);
+    QCOMPARE(toolpath.segments.count(), 1);
+    QCOMPARE(toolpath.indices.count(), 2);
+    QCOMPARE(toolpath.points.at(int(toolpath.indices.at(0))), QVector3D(0, 0, 0.2f));
+    QCOMPARE(toolpath.points.at(int(toolpath.indices.at(1))), QVector3D(10, 0, 0.2f));
+    QVERIFY(qAbs(toolpath.extrusion() - 1.0) < 1e-5);
+}
+
+// the vertices that are dropped are within the tolerance of the simplified
+// path, and a zigzag within the tolerance becomes a line
+void tst_GcodeSimplifier::decimateWithinTolerance()
+{
+    const int chords = 100;
+    const double radius = 10;
+    QByteArray gcode = "G90\nM83\nG1 F1200\nG0 X10 Y0 Z0.2\n";
+    for (int chord = 1; chord <= chords; ++chord) {
+        const double angle = M_PI * chord / chords;
+        gcode += "G1 X" + QByteArray::number(radius * std::cos(angle), 'f', 4)
+                + " Y" + QByteArray::number(radius * std::sin(angle), 'f', 4) + " E0.1\n";
+    }
+
+    const GcodeParser parser = parse(gcode);
+    const float tolerance = 0.05f;
+    Toolpath toolpath(parser);
+    toolpath.simplify(tolerance);
+    QVERIFY(toolpath.segments.count() > 1);
+    QVERIFY(toolpath.segments.count() < chords / 2);
+    QVERIFY(qAbs(toolpath.extrusion() - chords * 0.1) < 1e-4);
+    for (const QVector3D &point : parser.points()) {
+        float distance = std::numeric_limits<float>::max();
+        for (int i = 0; i < toolpath.indices.count(); i += 2) {
+            distance = qMin(distance, distanceToSegment(point, toolpath.points.at(int(toolpath.indices.at(i))),
+                                                        toolpath.points.at(int(toolpath.indices.at(i + 1)))));
+        }
+        QVERIFY(distance <= tolerance);
+    }
+
+    QByteArray zigzag = "G90\nM83\nG1 F1200\nG0 X0 Y0 Z0.2\n";
+    for (int x = 1; x <= 20; ++x)
+        zigzag += "G1 X" + QByteArray::number(x) + " Y" + QByteArray(x % 2 ? "0.02" : "0") + " E0.1\n";
+    Toolpath coarse(parse(zigzag));
+    coarse.simplify(0.05f);
+    QCOMPARE(coarse.segments.count(), 1);
+    Toolpath fine(parse(zigzag));
+    fine.simplify(0.01f);
+    QCOMPARE(fine.segments.count(), 20);
+}
+
+// runs end where the feedrate or the tool changes, or the path is broken
+void tst_GcodeSimplifier::keepRuns()
+{
+    QByteArray gcode = line(10);
+    gcode += "G1 X20 E1 F600\n";
+    gcode += "T1\nG1 X30 E1\n";
+    gcode += "G0 X40\nG1 X50 E1\n";
+
+    Toolpath toolpath(parse(gcode));
+    toolpath.simplify(0.05f);
+    QCOMPARE(toolpath.segments.count(), 4);
+    QCOMPARE(toolpath.segments.at(0).feedrate, 1200.0f);
+    QCOMPARE(toolpath.segments.at(1).feedrate, 600.0f);
+    QCOMPARE(toolpath.segments.at(2).tool, 1);
+    QCOMPARE(toolpath.points.at(int(toolpath.indices.at(6))), QVector3D(40, 0, 0.2f));
+    // continuous runs share their vertex
+    QCOMPARE(toolpath.indices.at(1), toolpath.indices.at(2));
+    QCOMPARE(toolpath.points.count(), 6);
+}
+
+// the layers start at the first segment of their simplified paths
+void tst_GcodeSimplifier::keepLayers()
+{
+    QByteArray gcode = line(10, 0.2f);
+    gcode += "G0 X0 Y0 Z0.4\n";
+    for (int x = 1; x <= 10; ++x)
+        gcode += "G1 X" + QByteArray::number(x) + " E0.1\n";
+
+    const GcodeParser parser = parse(gcode);
+    Toolpath toolpath(parser);
+    toolpath.simplify(0.05f);
+    QCOMPARE(toolpath.layers.count(), parser.layers().count());
+    QCOMPARE(toolpath.segments.count(), 2);
+    QCOMPARE(toolpath.layers.first().index, 0);
+    QCOMPARE(toolpath.layers.last().index, 2);
+    QCOMPARE(toolpath.points.at(int(toolpath.indices.at(2))).z(), 0.4f);
+}
+
+QTEST_APPLESS_MAIN(tst_GcodeSimplifier)
+
+#include "tst_gcodesimplifier.moc"